@@ -0,0 +1,140 @@
+/**
+ * @file Batch.cpp
+ */
+#include "Batch.h"
+#include "very.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+/**
+ * Redirects standard output for as long as it exists.
+ */
+class Redirection {
+	std::streambuf* previous;
+public:
+	Redirection(std::ostream& target)
+		: previous(std::cout.rdbuf(target.rdbuf())) {}
+	~Redirection() { std::cout.flush(); std::cout.rdbuf(previous); }
+};
+
+/**
+ * Constructs a batch whose programs start from the given prelude, and whose
+ * reference runs start from the given prelude evaluated without
+ * optimizations. Output files are written to the given directory, or beside
+ * their programs if it is empty.
+ */
+Batch::Batch(const Context& prelude, const Context& reference,
+	const Context::limits& limits, bool prefetch, const std::string& directory)
+	: prelude(prelude), reference(reference), limits(limits),
+	prefetch(prefetch), directory(directory), depth(0) {}
+
+/**
+ * Sets the greatest call depth at which builtins are compared.
+ */
+void Batch::set_depth(std::size_t value) {
+	depth = value;
+}
+
+/**
+ * Evaluates one program, writing its output to a file named after it with the
+ * extension ".out". Errors are reported with the name of the program rather
+ * than thrown, so that one failure does not end the batch. Positions in the
+ * program itself are given without its name, which would only be repeated,
+ * and positions in modules with the module's name. No pool of Terms is kept
+ * between runs: a run's Terms are all released with its Context, and the
+ * allocator hands that memory straight to the next run.
+ */
+bool Batch::run(const std::string& input) try {
+	std::filesystem::path path(input);
+	auto output = (directory.empty() ? path.parent_path()
+		: std::filesystem::path(directory)) / path.stem();
+	output += ".out";
+
+	std::ifstream source(input);
+	if (!source)
+		throw std::runtime_error("Unable to open input file.");
+	std::ofstream target(output);
+	if (!target)
+		throw std::runtime_error("Unable to open output file.");
+
+	Context context;
+	context.import(prelude);
+	context.set_limits(limits);
+	context.set_optimized(prelude.is_optimized());
+	Redirection redirection(target);
+	evaluate(source, context, prefetch);
+	return true;
+} catch (const std::exception& error) {
+	std::cerr << input << ": " << error.what() << '\n';
+	return false;
+}
+
+/**
+ * Runs a program with and without optimizations, and compares the output and
+ * the traces of the builtins evaluated up to the trace depth, neither of which
+ * optimizations may change. By default only builtins evaluated directly by
+ * the program are compared, since folding legitimately skips some of those
+ * within words. Any difference is reported.
+ */
+bool Batch::compare(const std::string& input) {
+	std::string outputs[2];
+	std::string traces[2];
+	for (int pass = 0; pass < 2; ++pass) {
+		std::ostringstream output;
+		std::ostringstream log;
+		{
+			Trace trace(log, depth);
+			Context context;
+			context.import(pass == 0 ? prelude : reference);
+			context.set_limits(limits);
+			context.set_optimized(pass == 0);
+			context.set_trace(&trace);
+			Redirection redirection(output);
+			try {
+				std::ifstream source(input);
+				if (!source)
+					throw std::runtime_error("Unable to open input file.");
+				evaluate(source, context, prefetch);
+			} catch (const std::exception& error) {
+				output << error.what() << '\n';
+			}
+		}
+		outputs[pass] = output.str();
+		traces[pass] = log.str();
+	}
+	const char* what = outputs[0] != outputs[1] ? "output"
+		: traces[0] != traces[1] ? "trace" : nullptr;
+	if (!what)
+		return true;
+	const auto& a = what[0] == 'o' ? outputs : traces;
+	auto difference = std::mismatch(a[0].begin(), a[0].end(),
+		a[1].begin(), a[1].end()).first - a[0].begin();
+	std::cerr << input << ": " << what << " differs at byte " << difference
+		<< " between optimized and reference runs.\n";
+	return false;
+}
+
+/**
+ * Expands directories in a list of programs into the ".very" files they
+ * contain, in order by name.
+ */
+std::vector<std::string> Batch::expand(const std::vector<std::string>& inputs) {
+	std::vector<std::string> result;
+	for (auto i = inputs.begin(); i != inputs.end(); ++i) {
+		if (!std::filesystem::is_directory(*i)) {
+			result.push_back(*i);
+			continue;
+		}
+		std::vector<std::string> programs;
+		for (const auto& entry : std::filesystem::directory_iterator(*i))
+			if (entry.path().extension() == ".very")
+				programs.push_back(entry.path().string());
+		std::sort(programs.begin(), programs.end());
+		result.insert(result.end(), programs.begin(), programs.end());
+	}
+	return result;
+}
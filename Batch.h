@@ -0,0 +1,33 @@
+/**
+ * @file Batch.h
+ */
+#ifndef BATCH_H
+#define BATCH_H
+#include "Context.h"
+#include <string>
+#include <vector>
+
+/**
+ * Evaluates many programs in one process. Each program runs in a fresh
+ * Context that starts with the definitions of a shared prelude, which is read
+ * and evaluated only once, and writes its standard output to its own file.
+ * Alternatively, each program can be run with and without optimizations and
+ * the results compared, starting from a prelude evaluated the same way.
+ */
+class Batch {
+	const Context& prelude;
+	const Context& reference;
+	Context::limits limits;
+	bool prefetch;
+	std::string directory;
+	std::size_t depth;
+public:
+	Batch(const Context&, const Context&, const Context::limits&, bool,
+		const std::string&);
+	void set_depth(std::size_t);
+	bool run(const std::string&);
+	bool compare(const std::string&);
+	static std::vector<std::string> expand(const std::vector<std::string>&);
+};
+
+#endif
@@ -0,0 +1,260 @@
+/**
+ * @file Bignum.cpp
+ */
+#include "Bignum.h"
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+
+/**
+ * Constructs a Bignum from a machine integer.
+ */
+Bignum::Bignum(int64_t value) : negative(value < 0) {
+	uint64_t magnitude = negative ? 0 - uint64_t(value) : uint64_t(value);
+	while (magnitude) {
+		limbs.push_back(uint32_t(magnitude));
+		magnitude >>= 32;
+	}
+}
+
+/**
+ * Constructs a Bignum from an optionally signed string of decimal digits.
+ */
+Bignum::Bignum(const std::string& text) : negative(false) {
+	auto i = text.begin();
+	bool sign = false;
+	if (i != text.end() && (*i == '-' || *i == '+'))
+		sign = *i++ == '-';
+	for (; i != text.end(); ++i)
+		multiply_add_small(10, *i - '0');
+	negative = sign && !limbs.empty();
+}
+
+/**
+ * Tests whether the value fits in a machine integer.
+ */
+bool Bignum::fits() const {
+	if (limbs.size() < 2) return true;
+	if (limbs.size() > 2) return false;
+	uint64_t magnitude = uint64_t(limbs[1]) << 32 | limbs[0];
+	return magnitude <= uint64_t(INT64_MAX) + negative;
+}
+
+/**
+ * Gets the value as a machine integer. Only valid if fits().
+ */
+int64_t Bignum::value() const {
+	uint64_t magnitude = 0;
+	for (auto i = limbs.rbegin(); i != limbs.rend(); ++i)
+		magnitude = magnitude << 32 | *i;
+	return negative ? int64_t(0 - magnitude) : int64_t(magnitude);
+}
+
+/**
+ * Gets the nearest floating-point value.
+ */
+double Bignum::to_real() const {
+	double result = 0;
+	for (auto i = limbs.rbegin(); i != limbs.rend(); ++i)
+		result = result * 4294967296.0 + *i;
+	return negative ? -result : result;
+}
+
+/**
+ * Adds Bignums.
+ */
+Bignum& Bignum::operator+=(const Bignum& other) {
+	if (negative == other.negative) {
+		add_magnitude(other);
+	} else if (compare_magnitude(*this, other) >= 0) {
+		subtract_magnitude(other);
+	} else {
+		Bignum result(other);
+		result.subtract_magnitude(*this);
+		*this = result;
+	}
+	if (limbs.empty()) negative = false;
+	return *this;
+}
+
+/**
+ * Subtracts Bignums.
+ */
+Bignum& Bignum::operator-=(const Bignum& other) {
+	Bignum negation(other);
+	if (!negation.limbs.empty()) negation.negative = !negation.negative;
+	return *this += negation;
+}
+
+/**
+ * Multiplies Bignums.
+ */
+Bignum& Bignum::operator*=(const Bignum& other) {
+	std::vector<uint32_t> result(limbs.size() + other.limbs.size());
+	for (std::size_t i = 0; i < limbs.size(); ++i) {
+		uint64_t carry = 0;
+		for (std::size_t j = 0; j < other.limbs.size(); ++j) {
+			uint64_t product = uint64_t(limbs[i]) * other.limbs[j]
+				+ result[i + j] + carry;
+			result[i + j] = uint32_t(product);
+			carry = product >> 32;
+		}
+		result[i + other.limbs.size()] = uint32_t(carry);
+	}
+	limbs.swap(result);
+	negative = negative != other.negative;
+	trim();
+	return *this;
+}
+
+/**
+ * Divides Bignums, truncating toward zero.
+ */
+Bignum& Bignum::operator/=(const Bignum& other) {
+	Bignum quotient, remainder;
+	divide(*this, other, quotient, remainder);
+	return *this = quotient;
+}
+
+/**
+ * Modulates Bignums. The result has the sign of the dividend.
+ */
+Bignum& Bignum::operator%=(const Bignum& other) {
+	Bignum quotient, remainder;
+	divide(*this, other, quotient, remainder);
+	return *this = remainder;
+}
+
+/**
+ * Sorts Bignums.
+ */
+bool operator<(const Bignum& a, const Bignum& b) {
+	if (a.negative != b.negative)
+		return a.negative;
+	int comparison = Bignum::compare_magnitude(a, b);
+	return a.negative ? comparison > 0 : comparison < 0;
+}
+
+/**
+ * Tests equality of Bignums.
+ */
+bool operator==(const Bignum& a, const Bignum& b) {
+	return a.negative == b.negative && a.limbs == b.limbs;
+}
+
+/**
+ * Writes a Bignum to a stream in decimal.
+ */
+std::ostream& operator<<(std::ostream& stream, const Bignum& value) {
+	if (value.limbs.empty())
+		return stream << 0;
+	std::vector<uint32_t> chunks;
+	Bignum magnitude(value);
+	while (!magnitude.limbs.empty())
+		chunks.push_back(magnitude.divide_small(1000000000));
+	if (value.negative) stream << '-';
+	stream << chunks.back();
+	for (auto i = chunks.rbegin() + 1; i != chunks.rend(); ++i)
+		stream << std::setw(9) << std::setfill('0') << *i;
+	return stream << std::setfill(' ');
+}
+
+/**
+ * Compares the magnitudes of Bignums, yielding -1, 0, or 1.
+ */
+int Bignum::compare_magnitude(const Bignum& a, const Bignum& b) {
+	if (a.limbs.size() != b.limbs.size())
+		return a.limbs.size() < b.limbs.size() ? -1 : 1;
+	for (auto i = a.limbs.size(); i--; )
+		if (a.limbs[i] != b.limbs[i])
+			return a.limbs[i] < b.limbs[i] ? -1 : 1;
+	return 0;
+}
+
+/**
+ * Divides Bignums by binary long division.
+ */
+void Bignum::divide(const Bignum& dividend, const Bignum& divisor,
+	Bignum& quotient, Bignum& remainder) {
+	if (divisor.limbs.empty())
+		throw std::runtime_error("Division by zero.");
+	quotient.limbs.assign(dividend.limbs.size(), 0);
+	remainder = Bignum();
+	for (auto bit = dividend.limbs.size() * 32; bit--; ) {
+		remainder.multiply_add_small(2, dividend.limbs[bit / 32] >> bit % 32 & 1);
+		if (compare_magnitude(remainder, divisor) >= 0) {
+			remainder.subtract_magnitude(divisor);
+			quotient.limbs[bit / 32] |= uint32_t(1) << bit % 32;
+		}
+	}
+	quotient.negative = dividend.negative != divisor.negative;
+	remainder.negative = dividend.negative;
+	quotient.trim();
+	remainder.trim();
+}
+
+/**
+ * Adds magnitudes, ignoring signs.
+ */
+void Bignum::add_magnitude(const Bignum& other) {
+	if (limbs.size() < other.limbs.size())
+		limbs.resize(other.limbs.size());
+	uint64_t carry = 0;
+	for (std::size_t i = 0; i < limbs.size(); ++i) {
+		uint64_t sum = carry + limbs[i]
+			+ (i < other.limbs.size() ? other.limbs[i] : 0);
+		limbs[i] = uint32_t(sum);
+		carry = sum >> 32;
+	}
+	if (carry) limbs.push_back(uint32_t(carry));
+}
+
+/**
+ * Subtracts a magnitude no greater than this one, ignoring signs.
+ */
+void Bignum::subtract_magnitude(const Bignum& other) {
+	int64_t borrow = 0;
+	for (std::size_t i = 0; i < limbs.size(); ++i) {
+		int64_t difference = int64_t(limbs[i]) - borrow
+			- (i < other.limbs.size() ? other.limbs[i] : 0);
+		borrow = difference < 0;
+		limbs[i] = uint32_t(difference + (borrow << 32));
+	}
+	trim();
+}
+
+/**
+ * Divides the magnitude by a small divisor, yielding the remainder.
+ */
+uint32_t Bignum::divide_small(uint32_t divisor) {
+	uint64_t remainder = 0;
+	for (auto i = limbs.size(); i--; ) {
+		uint64_t current = remainder << 32 | limbs[i];
+		limbs[i] = uint32_t(current / divisor);
+		remainder = current % divisor;
+	}
+	trim();
+	return uint32_t(remainder);
+}
+
+/**
+ * Multiplies the magnitude by a small factor and adds a small term.
+ */
+void Bignum::multiply_add_small(uint32_t factor, uint32_t term) {
+	uint64_t carry = term;
+	for (auto i = limbs.begin(); i != limbs.end(); ++i) {
+		uint64_t product = uint64_t(*i) * factor + carry;
+		*i = uint32_t(product);
+		carry = product >> 32;
+	}
+	if (carry) limbs.push_back(uint32_t(carry));
+}
+
+/**
+ * Removes leading zero limbs, normalizing zero to be nonnegative.
+ */
+void Bignum::trim() {
+	while (!limbs.empty() && !limbs.back())
+		limbs.pop_back();
+	if (limbs.empty()) negative = false;
+}
@@ -0,0 +1,42 @@
+/**
+ * @file Bignum.h
+ */
+#ifndef BIGNUM_H
+#define BIGNUM_H
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+/**
+ * An arbitrary-precision integer, used only for values that do not fit in a
+ * machine integer.
+ */
+class Bignum {
+	bool negative;
+	std::vector<uint32_t> limbs;
+public:
+	Bignum(int64_t = 0);
+	explicit Bignum(const std::string&);
+	bool fits() const;
+	int64_t value() const;
+	double to_real() const;
+	Bignum& operator+=(const Bignum&);
+	Bignum& operator-=(const Bignum&);
+	Bignum& operator*=(const Bignum&);
+	Bignum& operator/=(const Bignum&);
+	Bignum& operator%=(const Bignum&);
+	friend bool operator<(const Bignum&, const Bignum&);
+	friend bool operator==(const Bignum&, const Bignum&);
+	friend std::ostream& operator<<(std::ostream&, const Bignum&);
+private:
+	static int compare_magnitude(const Bignum&, const Bignum&);
+	static void divide(const Bignum&, const Bignum&, Bignum&, Bignum&);
+	void add_magnitude(const Bignum&);
+	void subtract_magnitude(const Bignum&);
+	uint32_t divide_small(uint32_t);
+	void multiply_add_small(uint32_t, uint32_t);
+	void trim();
+};
+
+#endif
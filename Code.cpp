@@ -0,0 +1,74 @@
+/**
+ * @file Code.cpp
+ */
+#include "Code.h"
+#include "Term.h"
+#include "Usage.h"
+#include <limits>
+#include <unordered_set>
+#include <utility>
+
+/**
+ * Releases a Code.
+ */
+Code::~Code() {
+	Usage::charge(-int64_t(nodes.capacity() * sizeof(Node)
+		+ values.capacity() * sizeof(std::shared_ptr<Term>)));
+}
+
+/**
+ * Flattens a quotation, and each nested quotation not already flattened, into
+ * a single Code owned by the outermost quotation. A nested quotation reached
+ * more than once is flattened only the first time, so the Code stays
+ * proportional to the number of distinct Terms. Quotations too large to index
+ * are left in pointer form.
+ */
+void Code::compile(Term& root) {
+	auto code = std::make_shared<Code>();
+	std::vector<std::pair<Term*, uint32_t>> nested;
+	std::unordered_set<const Term*> visited;
+	// Each level holds a quotation, the next element to flatten, and the node
+	// that pushes the quotation.
+	struct Level { const Term* term; std::size_t index; std::size_t node; };
+	std::vector<Level> levels { { &root, 0, 0 } };
+	while (!levels.empty()) {
+		auto& level = levels.back();
+		if (level.index == level.term->values.size()) {
+			if (levels.size() > 1)
+				code->nodes[level.node].span
+					= code->nodes.size() - level.node - 1;
+			levels.pop_back();
+			continue;
+		}
+		if (code->nodes.size() == std::numeric_limits<uint32_t>::max())
+			return;
+		const auto& element = level.term->values[level.index++];
+		Node node { VALUE, 0, 0, element.get() };
+		if (element->type != Term::SPECIAL || element->tag == Term::ARRAY) {
+			node.immediate = code->values.size();
+			code->values.push_back(element);
+		} else {
+			node.kind = element->tag == Term::SYMBOL ? SYMBOL : OPERATION;
+			node.immediate = element->tag;
+		}
+		code->nodes.push_back(node);
+		if (element->type == Term::SPECIAL && element->tag == Term::ARRAY
+			&& !element->code && element->enclosing.expired()
+			&& visited.insert(element.get()).second) {
+			nested.emplace_back(element.get(), code->nodes.size());
+			levels.push_back({ element.get(), 0, code->nodes.size() - 1 });
+		}
+	}
+	code->nodes.shrink_to_fit();
+	code->values.shrink_to_fit();
+	Usage::charge(code->nodes.capacity() * sizeof(Node)
+		+ code->values.capacity() * sizeof(std::shared_ptr<Term>));
+	root.code = code;
+	root.code_begin = 0;
+	root.code_end = code->nodes.size();
+	for (auto i = nested.begin(); i != nested.end(); ++i) {
+		i->first->enclosing = code;
+		i->first->code_begin = i->second;
+		i->first->code_end = i->second + code->nodes[i->second - 1].span;
+	}
+}
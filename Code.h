@@ -0,0 +1,43 @@
+/**
+ * @file Code.h
+ */
+#ifndef CODE_H
+#define CODE_H
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class Term;
+
+/**
+ * A quotation flattened into a contiguous preorder array of nodes, so that
+ * applying it is a linear scan rather than a walk over Terms scattered across
+ * the heap. Values keep their pointer form, since pushing one lets it escape
+ * to the stack. The nodes of a nested quotation follow the node that pushes
+ * it, and are skipped over by its span, so that applying the nested quotation
+ * later scans the same array for as long as the outermost quotation keeps it.
+ * Only the outermost quotation owns its Code; nested ones refer to it weakly,
+ * since the Code holds them among its values.
+ */
+class Code {
+public:
+	enum Kind : uint8_t { VALUE, SYMBOL, OPERATION };
+	struct Node {
+		Kind kind;
+		/// Number of nodes belonging to a nested quotation.
+		uint32_t span;
+		/// Index of a value, or the builtin operation.
+		int64_t immediate;
+		/// Term the node was flattened from.
+		Term* term;
+	};
+	std::vector<Node> nodes;
+	std::vector<std::shared_ptr<Term>> values;
+	Code() = default;
+	Code(const Code&) = delete;
+	Code& operator=(const Code&) = delete;
+	~Code();
+	static void compile(Term&);
+};
+
+#endif
@@ -1,14 +1,50 @@
 #include "Context.h"
+#include "Module.h"
+#include "Text.h"
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <stdexcept>
+#include <sys/resource.h>
 #include <utf8.h>
 
+/**
+ * Converts a character array Term to a UTF-8 string.
+ */
+static std::string utf8_name(const Term& raw_name) {
+	if (raw_name.text)
+		return raw_name.text->data();
+	std::string name;
+	for (auto i = raw_name.values.begin(); i != raw_name.values.end(); ++i) {
+		auto c = (*i)->tag;
+		if ((*i)->type != Term::SCALAR || c < 0 || c > 0x10FFFF
+			|| (c >= 0xD800 && c <= 0xDFFF))
+			throw std::runtime_error("Invalid character in name.");
+		utf8::append((*i)->tag, std::back_inserter(name));
+	}
+	return name;
+}
+
+/**
+ * Issues a generation that no other Context has used, so that symbols cached
+ * against one set of words are never mistaken for another.
+ */
+uint64_t Context::next_generation() {
+	static std::atomic<uint64_t> counter(0);
+	return ++counter;
+}
+
 /**
  * Constructs a default context with initial constants and ports.
  */
-Context::Context() {
+Context::Context()
+	: folding(0), verbose(false), generation(next_generation()), hits(0),
+	misses(0), steps(0), allocated(0), depth(0), optimized(true),
+	trace(nullptr), positions_limit(1024), parent(nullptr) {
 	ports.push_back(&std::cin);
 	ports.push_back(&std::cout);
 	ports.push_back(&std::cerr);
@@ -17,6 +53,38 @@ Context::Context() {
 	words["stdin"]  = std::make_shared<Term>(0);
 	words["stdout"] = std::make_shared<Term>(1);
 	words["stderr"] = std::make_shared<Term>(2);
+	for (auto i = words.begin(); i != words.end(); ++i)
+		unfolded.insert(i->first);
+}
+
+/**
+ * Constructs a worker context for evaluation on another thread. It has its own
+ * stack and no ports, and reads words from its parent, which must not change
+ * while the worker exists. The memory left to the parent is shared equally
+ * among the given number of workers.
+ */
+Context::Context(const Context* parent, std::size_t workers)
+	: folding(0), verbose(false), generation(parent->generation), hits(0),
+	misses(0), limit(parent->limit), steps(0), allocated(0),
+	depth(parent->depth), optimized(parent->optimized), trace(nullptr),
+	positions_limit(0), parent(parent) {
+	limit.steps -= std::min(parent->steps, limit.steps);
+	limit.memory -= std::min<std::size_t>
+		(std::max<int64_t>(parent->allocated, 0), limit.memory);
+	limit.memory /= workers;
+}
+
+/**
+ * Replaces the words, tokens, and macros of this Context with those of
+ * another. Bodies are shared rather than copied, which is safe because they
+ * are never modified once defined.
+ */
+void Context::import(const Context& other) {
+	words = other.words;
+	unfolded = other.unfolded;
+	constants = other.constants;
+	tokens = other.tokens;
+	macros = other.macros;
 }
 
 /**
@@ -24,9 +92,7 @@ Context::Context() {
  */
 void Context::define_word
 	(std::shared_ptr<Term> raw_name, std::shared_ptr<Term> body) {
-	std::string name;
-	for (auto i = raw_name->values.begin(); i != raw_name->values.end(); ++i)
-		utf8::append((*i)->tag, std::back_inserter(name));
+	auto name = utf8_name(*raw_name);
 	auto existing = words.find(name);
 	if (existing != words.end()) {
 		std::ostringstream message;
@@ -34,15 +100,15 @@ void Context::define_word
 		throw std::runtime_error(message.str());
 	}
 	words[name] = body;
+	if (is_constant_body(body))
+		unfolded.insert(name);
 }
 
 /**
  * Makes a character sequence function as a token.
  */
 void Context::define_token(std::shared_ptr<Term> raw_name) {
-	std::string name;
-	for (auto i = raw_name->values.begin(); i != raw_name->values.end(); ++i)
-		utf8::append((*i)->tag, std::back_inserter(name));
+	auto name = utf8_name(*raw_name);
 	auto existing = std::find(tokens.begin(), tokens.end(), name);
 	if (existing != tokens.end()) {
 		std::ostringstream message;
@@ -53,44 +119,713 @@ void Context::define_token(std::shared_ptr<Term> raw_name) {
 	std::sort(tokens.begin(), tokens.end());
 }
 
+/**
+ * Defines a macro, which rewrites the Term following its name at expansion
+ * time into whatever its body leaves on an otherwise empty stack.
+ */
+void Context::define_macro
+	(std::shared_ptr<Term> raw_name, std::shared_ptr<Term> body) {
+	auto name = utf8_name(*raw_name);
+	if (macros.count(name) || words.count(name)) {
+		std::ostringstream message;
+		message << "Redefinition of symbol \"" << name << "\" as a macro.";
+		throw std::runtime_error(message.str());
+	}
+	macros[name].body = body;
+}
+
+/**
+ * Makes the words, tokens, and macros defined by a module available. The path
+ * is relative to the working directory. A module already required is not
+ * loaded again, but a definition that conflicts with an existing one is an
+ * error.
+ */
+void Context::require(std::shared_ptr<Term> raw_name) {
+	check_files();
+	auto module = Module::load(utf8_name(*raw_name), *this);
+	const auto& source = module->context;
+	for (auto i = module->defined.begin(); i != module->defined.end(); ++i) {
+		auto body = source.words.at(*i);
+		auto existing = words.find(*i);
+		if (existing != words.end() && existing->second == body)
+			continue;
+		if (existing != words.end() || macros.count(*i)) {
+			std::ostringstream message;
+			message << "Redefinition of symbol \"" << *i << "\" by module.";
+			throw std::runtime_error(message.str());
+		}
+		words[*i] = body;
+		if (source.unfolded.count(*i))
+			unfolded.insert(*i);
+		if (source.constants.count(*i))
+			constants.insert(*i);
+	}
+	for (auto i = source.macros.begin(); i != source.macros.end(); ++i) {
+		auto existing = macros.find(i->first);
+		if (existing != macros.end() && existing->second.body == i->second.body)
+			continue;
+		if (existing != macros.end() || words.count(i->first)) {
+			std::ostringstream message;
+			message << "Redefinition of macro \"" << i->first << "\" by module.";
+			throw std::runtime_error(message.str());
+		}
+		macros.insert(*i);
+	}
+	for (auto i = source.tokens.begin(); i != source.tokens.end(); ++i)
+		if (!std::binary_search(tokens.begin(), tokens.end(), *i))
+			tokens.insert
+				(std::upper_bound(tokens.begin(), tokens.end(), *i), *i);
+}
+
+/**
+ * Tests whether a symbol names a macro.
+ */
+bool Context::is_macro(std::shared_ptr<Term> raw_name) const {
+	return !macros.empty() && macros.count(utf8_name(*raw_name));
+}
+
+/**
+ * Expands a macro applied to an argument. Macros are expected to be pure, so
+ * each distinct argument is expanded only once and the result reused.
+ */
+const std::vector<std::shared_ptr<Term>>& Context::expand_macro
+	(std::shared_ptr<Term> raw_name, std::shared_ptr<Term> argument) {
+	auto& definition = macros.at(utf8_name(*raw_name));
+	auto existing = definition.expansions.find(argument);
+	if (existing != definition.expansions.end())
+		return existing->second;
+	std::deque<std::shared_ptr<Term>> stack;
+	stack.push_back(argument);
+	terms.swap(stack);
+	try {
+		definition.body->apply(*this);
+	} catch (...) {
+		terms.swap(stack);
+		throw;
+	}
+	terms.swap(stack);
+	auto& result = definition.expansions[argument];
+	result.assign(stack.begin(), stack.end());
+	return result;
+}
+
+/**
+ * Adds a port to the port table, reusing a closed slot if there is one.
+ */
+uint32_t Context::add_port(port value) {
+	for (uint32_t i = 0; i < ports.size(); ++i) {
+		if (ports[i].type == CLOSED) {
+			ports[i] = std::move(value);
+			return i;
+		}
+	}
+	ports.push_back(std::move(value));
+	return ports.size() - 1;
+}
+
+/**
+ * Gets the open port with the given number.
+ */
+Context::port& Context::get_port(uint32_t index) {
+	if (folding)
+		throw std::runtime_error("Ports cannot be used while folding.");
+	if (parent)
+		throw std::runtime_error("Ports cannot be used by pmap.");
+	if (index >= ports.size() || ports[index].type == CLOSED)
+		throw std::runtime_error("Invalid port number.");
+	return ports[index];
+}
+
+/**
+ * Opens the named file for reading.
+ */
+uint32_t Context::open_input(std::shared_ptr<Term> raw_name) {
+	check_files();
+	auto name = utf8_name(*raw_name);
+	std::unique_ptr<std::ifstream> file(new std::ifstream(name));
+	if (!*file) {
+		std::ostringstream message;
+		message << "Unable to open \"" << name << "\" for reading.";
+		throw std::runtime_error(message.str());
+	}
+	port result(file.get());
+	result.file = std::move(file);
+	return add_port(std::move(result));
+}
+
+/**
+ * Opens the named file for writing.
+ */
+uint32_t Context::open_output(std::shared_ptr<Term> raw_name) {
+	check_files();
+	auto name = utf8_name(*raw_name);
+	std::unique_ptr<std::ofstream> file(new std::ofstream(name));
+	if (!*file) {
+		std::ostringstream message;
+		message << "Unable to open \"" << name << "\" for writing.";
+		throw std::runtime_error(message.str());
+	}
+	port result(file.get());
+	result.file = std::move(file);
+	return add_port(std::move(result));
+}
+
+/**
+ * Opens an in-memory port that accumulates characters written to it.
+ */
+uint32_t Context::open_buffer() {
+	port result(static_cast<std::ostream*>(nullptr));
+	result.type = BUFFER;
+	return add_port(std::move(result));
+}
+
+/**
+ * Opens a port that reads the text produced by a quotation. The quotation is
+ * applied to a private stack holding the seed, and must leave a new seed and
+ * a chunk of text, either a string or a character; an empty string ends the
+ * stream. It is applied only when a reader needs more text.
+ */
+uint32_t Context::open_generator
+	(std::shared_ptr<Term> seed, std::shared_ptr<Term> quotation) {
+	port result(static_cast<std::istream*>(nullptr));
+	result.type = GENERATOR;
+	result.generator.reset(new Generator(produce(seed, quotation)));
+	return add_port(std::move(result));
+}
+
+/**
+ * Produces the chunks of a generator port. Each chunk is produced by one
+ * application of the quotation, between suspensions, so the evaluator itself
+ * never needs to suspend.
+ */
+Generator Context::produce
+	(std::shared_ptr<Term> seed, std::shared_ptr<Term> quotation) {
+	std::deque<std::shared_ptr<Term>> stack { seed };
+	while (true) {
+		std::shared_ptr<Term> chunk;
+		terms.swap(stack);
+		try {
+			quotation->apply(*this);
+			chunk = pop();
+		} catch (...) {
+			terms.swap(stack);
+			throw;
+		}
+		terms.swap(stack);
+		std::string text;
+		if (chunk->type == Term::STRING) {
+			text = chunk->text->data();
+		} else if (chunk->type == Term::SCALAR
+			&& chunk->tag >= 0 && chunk->tag <= 0x10FFFF
+			&& (chunk->tag < 0xD800 || chunk->tag > 0xDFFF)) {
+			utf8::append(chunk->tag, std::back_inserter(text));
+		} else {
+			throw std::runtime_error
+				("A generator must yield a string or a character.");
+		}
+		if (text.empty())
+			co_return;
+		co_yield std::move(text);
+	}
+}
+
+/**
+ * Refills the buffer of a generator port with its next chunk. Yields false
+ * once the stream has ended. The producer may open ports of its own, so the
+ * port is found again by number after it runs.
+ */
+bool Context::generate(uint32_t index) {
+	auto generator = get_port(index).generator.get();
+	std::string chunk;
+	if (!generator->next(chunk))
+		return false;
+	auto& source = get_port(index);
+	source.buffer = std::move(chunk);
+	source.consumed = 0;
+	return true;
+}
+
+/**
+ * Closes a port, flushing and releasing any file it owns.
+ */
+void Context::close_port(uint32_t index) {
+	auto& existing = get_port(index);
+	if (index < 3)
+		throw std::runtime_error("Standard ports cannot be closed.");
+	if (existing.generator && existing.generator->is_running())
+		throw std::runtime_error("A generator cannot close its own port.");
+	existing = port(static_cast<std::istream*>(nullptr));
+	existing.type = CLOSED;
+}
+
+/**
+ * Writes a character to a port.
+ */
+void Context::put(uint32_t index, uint32_t character) {
+	auto& target = get_port(index);
+	if (target.type == BUFFER) {
+		utf8::append(character, std::back_inserter(target.buffer));
+		return;
+	}
+	utf8::append(character,
+		std::ostreambuf_iterator<char>(get_output_port(index)));
+}
+
+/**
+ * Writes a sequence of characters to a port in one operation.
+ */
+void Context::put(uint32_t index, const std::vector<uint32_t>& characters) {
+	auto& target = get_port(index);
+	if (target.type == BUFFER) {
+		utf8::utf32to8(characters.begin(), characters.end(),
+			std::back_inserter(target.buffer));
+		return;
+	}
+	std::string encoded;
+	encoded.reserve(characters.size());
+	utf8::utf32to8(characters.begin(), characters.end(),
+		std::back_inserter(encoded));
+	get_output_port(index).write(encoded.data(), encoded.size());
+}
+
+/**
+ * Writes UTF-8 text to a port in one operation.
+ */
+void Context::put(uint32_t index, const std::string& text) {
+	auto& target = get_port(index);
+	if (target.type == BUFFER) {
+		target.buffer += text;
+		return;
+	}
+	get_output_port(index).write(text.data(), text.size());
+}
+
+/**
+ * Reads up to the given number of characters from a port as one string.
+ */
+std::shared_ptr<Term> Context::read(uint32_t index, std::size_t count) {
+	std::string result;
+	if (get_port(index).type == GENERATOR) {
+		while (count) {
+			auto* source = &get_port(index);
+			if (source->consumed == source->buffer.size()) {
+				if (!generate(index))
+					break;
+				source = &get_port(index);
+			}
+			auto begin = source->buffer.begin() + source->consumed;
+			auto end = begin;
+			for (; count && end != source->buffer.end(); --count)
+				utf8::unchecked::next(end);
+			result.append(begin, end);
+			source->consumed = end - source->buffer.begin();
+		}
+		return std::make_shared<Term>(std::make_shared<Text>(result));
+	}
+	std::istreambuf_iterator<char> source(get_input_port(index)), end;
+	try {
+		while (count-- && source != end)
+			utf8::append(utf8::next(source, end), std::back_inserter(result));
+	} catch (const utf8::exception&) {
+		throw std::runtime_error("Invalid UTF-8 in input.");
+	}
+	return std::make_shared<Term>(std::make_shared<Text>(result));
+}
+
+/**
+ * Yields the text accumulated by a buffer port as one string, and empties the
+ * buffer so that it can be reused. A generator port yields the rest of its
+ * stream.
+ */
+std::shared_ptr<Term> Context::contents(uint32_t index) {
+	if (get_port(index).type == GENERATOR) {
+		std::string result;
+		do {
+			auto& source = get_port(index);
+			result.append(source.buffer, source.consumed);
+			source.consumed = source.buffer.size();
+		} while (generate(index));
+		return std::make_shared<Term>(std::make_shared<Text>(result));
+	}
+	auto& source = get_port(index);
+	if (source.type != BUFFER)
+		throw std::runtime_error("Only buffer ports have contents.");
+	auto result = std::make_shared<Text>(std::move(source.buffer));
+	source.buffer.clear();
+	return std::make_shared<Term>(result);
+}
+
 /**
  * Gets the input stream associated with the given port number.
  */
 std::istream& Context::get_input_port(uint32_t index) {
-	if (index >= ports.size())
-		throw std::runtime_error("Invalid port number.");
-	if (ports[index].type == OSTREAM)
+	auto& source = get_port(index);
+	if (source.type != INPUT)
 		throw std::runtime_error("Output port cannot be used for input.");
-	return *ports[index].pointer.i;
+	return *source.input;
 }
 
 /**
  * Gets the output stream associated with the given port number.
  */
 std::ostream& Context::get_output_port(uint32_t index) {
-	if (index >= ports.size())
-		throw std::runtime_error("Invalid port number.");
-	if (ports[index].type == ISTREAM)
+	auto& target = get_port(index);
+	if (target.type == INPUT)
 		throw std::runtime_error("Input port cannot be used for output.");
-	return *ports[index].pointer.o;
+	if (target.type == BUFFER)
+		throw std::runtime_error("Buffer port has no output stream.");
+	if (target.type == GENERATOR)
+		throw std::runtime_error("Generator port cannot be used for output.");
+	return *target.output;
 }
 
 /**
  * Gets the word with the given name.
  */
 std::shared_ptr<Term> Context::get_word(std::shared_ptr<Term> raw_name) {
-	std::string name;
-	for (auto i = raw_name->values.begin(); i != raw_name->values.end(); ++i)
-		utf8::append((*i)->tag, std::back_inserter(name));
-	auto existing = words.find(name);
-	if (existing == words.end()) {
+	auto name = utf8_name(*raw_name);
+	const auto& dictionary = parent ? parent->words : words;
+	auto existing = dictionary.find(name);
+	if (existing == dictionary.end()) {
 		std::ostringstream message;
 		message << "Use of undefined symbol \"" << name << "\".";
 		throw std::runtime_error(message.str());
 	}
+	if (!parent && optimized && unfolded.count(name))
+		fold(name);
 	return existing->second;
 }
 
+/**
+ * Gets the values of a word that folds to a constant, or null if the word is
+ * not constant. Folds the word if it has not been used yet.
+ */
+std::shared_ptr<Term> Context::get_constant(std::shared_ptr<Term> raw_name) {
+	if (!optimized)
+		return std::shared_ptr<Term>();
+	auto name = utf8_name(*raw_name);
+	if (unfolded.count(name))
+		fold(name);
+	if (!constants.count(name))
+		return std::shared_ptr<Term>();
+	return words[name];
+}
+
+/**
+ * Enables reporting of folded definitions.
+ */
+void Context::set_verbose(bool value) {
+	verbose = value;
+}
+
+/**
+ * Identifies the current set of words. Changes whenever existing words might
+ * be replaced rather than extended.
+ */
+uint64_t Context::get_generation() const {
+	return generation;
+}
+
+/**
+ * Records whether a symbol lookup was served by its inline cache.
+ */
+void Context::count_lookup(bool hit) {
+	++(hit ? hits : misses);
+}
+
+/**
+ * Constructs unlimited bounds, except for call depth, which is bounded so that
+ * runaway recursion is reported instead of overflowing the native stack.
+ */
+Context::limits::limits()
+	: steps(std::numeric_limits<uint64_t>::max()),
+	memory(std::numeric_limits<std::size_t>::max()),
+	stack(std::numeric_limits<std::size_t>::max()),
+	depth(10000), files(true) {}
+
+/**
+ * Sets the bounds on the rest of the run.
+ */
+void Context::set_limits(const limits& value) {
+	limit = value;
+}
+
+/**
+ * Ensures that the run may use files.
+ */
+void Context::check_files() const {
+	if (!limit.files)
+		throw LimitError("Files cannot be used in this run.");
+}
+
+/**
+ * Counts an evaluation step.
+ */
+void Context::step() {
+	if (++steps > limit.steps)
+		throw LimitError("Step limit exceeded.");
+}
+
+/**
+ * Tests whether the native stack of the calling thread is nearly used up. The
+ * shallowest call seen on a thread marks the top of its stack, which is taken
+ * to be RLIMIT_STACK long, as it is for the main thread and by default for any
+ * other. An eighth is held back for the work done between calls.
+ */
+static bool stack_exhausted() {
+	static const std::uintptr_t budget = [] {
+		std::uintptr_t size = 8 << 20;
+		rlimit limit;
+		if (getrlimit(RLIMIT_STACK, &limit) == 0
+			&& limit.rlim_cur != RLIM_INFINITY)
+			size = limit.rlim_cur;
+		return size - size / 8;
+	}();
+	thread_local std::uintptr_t top = 0;
+	char here;
+	auto address = reinterpret_cast<std::uintptr_t>(&here);
+	if (address > top)
+		top = address;
+	return top - address > budget;
+}
+
+/**
+ * Counts entry into a body. The native stack bounds the depth as well as the
+ * limit does, so that deep recursion is reported rather than overflowing it.
+ */
+void Context::enter() {
+	if (++depth > limit.depth || stack_exhausted()) {
+		--depth;
+		throw LimitError("Call depth limit exceeded.");
+	}
+}
+
+/**
+ * Counts exit from a body.
+ */
+void Context::leave() {
+	--depth;
+}
+
+/**
+ * Ensures that the given number of bytes can be allocated for Terms without
+ * exceeding the memory limit.
+ */
+void Context::reserve(std::size_t bytes) {
+	std::size_t used = std::max<int64_t>(allocated, 0);
+	if (used > limit.memory || bytes > limit.memory - used)
+		throw LimitError("Memory limit exceeded.");
+}
+
+/**
+ * Charges the Terms, strings, and Codes allocated and released on this thread
+ * to this Context until the returned guard is destroyed.
+ */
+Usage Context::track() {
+	return Usage(allocated);
+}
+
+/**
+ * Tests whether this is a worker context.
+ */
+bool Context::is_worker() const {
+	return parent;
+}
+
+/**
+ * Enables or disables optimizations that do not change the meaning of a
+ * program: constant folding, inline caches, in-place updates, fast paths for
+ * common quotations, and parallel evaluation. With them disabled, evaluation
+ * serves as a reference for differential testing.
+ */
+void Context::set_optimized(bool value) {
+	optimized = value;
+}
+
+/**
+ * Tests whether optimizations are enabled.
+ */
+bool Context::is_optimized() const {
+	return optimized;
+}
+
+/**
+ * Sets the trace in which builtins are recorded, or null for none.
+ */
+void Context::set_trace(Trace* value) {
+	trace = value;
+}
+
+/**
+ * Records a builtin in the trace, if any, given the size of the stack before
+ * it ran. Builtins evaluated while folding are not recorded, because folding
+ * happens only when optimizing.
+ */
+void Context::record(int64_t operation, std::size_t before) {
+	if (trace && !folding)
+		trace->record(operation, depth, before, terms.size(),
+			terms.empty() ? nullptr : terms.back().get());
+}
+
+/**
+ * Keeps the name of a source for the positions of the Terms read from it.
+ * The name stays valid for as long as this Context.
+ */
+const std::string* Context::name_source(const std::string& name) {
+	return &*sources.insert(name).first;
+}
+
+/**
+ * Records the position of a Term in source. Entries for released Terms are
+ * swept out whenever the table doubles in size, so it stays proportional to
+ * the number of live Terms.
+ */
+void Context::locate(const std::shared_ptr<Term>& term, const Position& position) {
+	positions[term.get()] = std::make_pair(std::weak_ptr<Term>(term), position);
+	if (positions.size() < positions_limit)
+		return;
+	for (auto i = positions.begin(); i != positions.end(); )
+		if (i->second.first.expired())
+			i = positions.erase(i);
+		else
+			++i;
+	positions_limit = std::max<std::size_t>(1024, positions.size() * 2);
+}
+
+/**
+ * Rethrows an error raised while evaluating a Term with the Term's position in
+ * source, if it is known and the error does not have a position already.
+ * Otherwise returns, and the caller rethrows the error unchanged. Workers
+ * record no positions, so they consult the Context that started them. Errors
+ * raised while folding are left as they are, so that fold() can tell an
+ * exceeded limit from a word that cannot be folded.
+ */
+void Context::rethrow_located
+	(const Term& term, const std::runtime_error& error) const {
+	if (folding || dynamic_cast<const LocatedError*>(&error))
+		return;
+	auto root = this;
+	while (root->parent)
+		root = root->parent;
+	const auto& table = root->positions;
+	auto existing = table.find(&term);
+	if (existing == table.end() || existing->second.first.expired())
+		return;
+	throw LocatedError(existing->second.second, error.what());
+}
+
+/**
+ * Accounts for the work done by a finished worker or module context.
+ */
+void Context::merge(const Context& worker) {
+	hits += worker.hits;
+	misses += worker.misses;
+	steps += worker.steps;
+	allocated += worker.allocated;
+	if (steps > limit.steps)
+		throw LimitError("Step limit exceeded.");
+}
+
+/**
+ * Reports how often symbol lookups were served by their inline caches.
+ */
+void Context::print_statistics(std::ostream& stream) const {
+	auto total = hits + misses;
+	stream << "Symbol lookups: " << total << ", cached: " << hits;
+	if (total)
+		stream << " (" << hits * 100 / total << "%)";
+	stream << '\n';
+}
+
+/**
+ * Tests whether a body consists only of literals, builtins without effects,
+ * and words that may themselves be constant, making it a candidate for
+ * folding.
+ */
+bool Context::is_constant_body(std::shared_ptr<Term> body) {
+	if (body->type != Term::SPECIAL)
+		return body->type != Term::STRING;
+	if (body->tag != Term::ARRAY)
+		return false;
+	int inputs, outputs;
+	for (auto i = body->values.begin(); i != body->values.end(); ++i) {
+		const Term& term = **i;
+		if (term.type != Term::SPECIAL || term.tag == Term::ARRAY)
+			continue;
+		if (term.tag == Term::SYMBOL) {
+			auto name = utf8_name(term);
+			if (!unfolded.count(name) && !constants.count(name))
+				return false;
+		} else if (!Term::stack_effect(term.tag, inputs, outputs)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Counts a fold as a call for as long as it exists, since folding a word first
+ * folds the words it uses, as evaluating it would call them.
+ */
+class Folding {
+	Context& context;
+public:
+	Folding(Context& context) : context(context) { context.enter(); }
+	~Folding() { context.leave(); }
+};
+
+/**
+ * Evaluates a constant candidate once, on a private stack, and replaces its
+ * body with the resulting values. Leaves the word as it was if its body
+ * would consume values from its caller or fails to evaluate, but lets an
+ * exceeded limit end the run, as it would without folding.
+ */
+bool Context::fold(const std::string& name) {
+	unfolded.erase(name);
+	Folding call(*this);
+	auto body = words[name];
+	if (body->type == Term::SPECIAL) {
+		int depth = 0, inputs, outputs;
+		for (auto i = body->values.begin(); i != body->values.end(); ++i) {
+			const Term& term = **i;
+			if (term.type != Term::SPECIAL || term.tag == Term::ARRAY) {
+				++depth;
+			} else if (term.tag == Term::SYMBOL) {
+				auto constant = get_constant(*i);
+				if (!constant) return false;
+				depth += constant->values.size();
+			} else {
+				Term::stack_effect(term.tag, inputs, outputs);
+				if (depth < inputs) return false;
+				depth += outputs - inputs;
+			}
+		}
+	}
+	std::deque<std::shared_ptr<Term>> stack;
+	terms.swap(stack);
+	++folding;
+	try {
+		body->apply(*this);
+	} catch (const LimitError&) {
+		--folding;
+		terms.swap(stack);
+		throw;
+	} catch (const std::runtime_error&) {
+		--folding;
+		terms.swap(stack);
+		return false;
+	}
+	--folding;
+	terms.swap(stack);
+	auto result = std::make_shared<Term>();
+	result->values.assign(stack.begin(), stack.end());
+	words[name] = result;
+	constants.insert(name);
+	if (verbose)
+		std::cerr << "Folded \"" << name << "\" to " << *result << ".\n";
+	return true;
+}
+
 /**
  * Yields the top element of the stack and removes it.
  */
@@ -103,9 +838,13 @@ std::shared_ptr<Term> Context::pop() {
 }
 
 /**
- * Pushes the given value to the stack.
+ * Pushes the given value to the stack, enforcing the stack and memory limits.
  */
 void Context::push(std::shared_ptr<Term> value) {
+	if (terms.size() >= limit.stack)
+		throw LimitError("Stack limit exceeded.");
+	value->account();
+	reserve(0);
 	terms.push_back(value);
 }
 
@@ -118,6 +857,13 @@ std::shared_ptr<Term> Context::top() const {
 	return terms.back();
 }
 
+/**
+ * Gets the number of elements on the stack.
+ */
+std::size_t Context::size() const {
+	return terms.size();
+}
+
 /**
  * Gets a begin iterator to the declared tokens.
  */
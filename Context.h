@@ -1,53 +1,170 @@
 #ifndef CONTEXT_H
 #define CONTEXT_H
+#include "Generator.h"
+#include "Position.h"
 #include "Term.h"
+#include "Trace.h"
+#include "Usage.h"
 #include <deque>
+#include <ios>
 #include <map>
 #include <memory>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+#include <string>
 #include <vector>
 
+/**
+ * An error raised when a run exceeds one of its limits. It ends the run even
+ * where other errors are taken to mean only that a word cannot be folded.
+ */
+class LimitError : public std::runtime_error {
+public:
+	explicit LimitError(const std::string& message)
+		: std::runtime_error(message) {}
+};
+
 class Context {
 
+	friend class Image;
+	friend class Module;
+
+public:
+
+	/// Bounds on a run. Each is unlimited unless set.
+	struct limits {
+		limits();
+		uint64_t steps;
+		std::size_t memory;
+		std::size_t stack;
+		std::size_t depth;
+		bool files;
+	};
+
+private:
+
 	std::map<std::string, std::shared_ptr<Term>> words;
+	std::set<std::string> unfolded;
+	std::set<std::string> constants;
+	int folding;
+	bool verbose;
+	uint64_t generation;
+	uint64_t hits;
+	uint64_t misses;
+	limits limit;
+	uint64_t steps;
+	int64_t allocated;
+	std::size_t depth;
+	bool optimized;
+	Trace* trace;
+
+	/// Positions of Terms in source, checked against a weak reference since a
+	/// Term's address may be reused once it is released.
+	std::unordered_map<const Term*, std::pair<std::weak_ptr<Term>, Position>>
+		positions;
+	std::size_t positions_limit;
+	std::set<std::string> sources;
 	std::deque<std::shared_ptr<Term>> terms;
 	std::vector<std::string> tokens;
+	const Context* parent;
 
-	enum stream_type {
-		ISTREAM,
-		OSTREAM,
-		IOSTREAM
+	struct macro {
+		std::shared_ptr<Term> body;
+		std::map<std::shared_ptr<Term>, std::vector<std::shared_ptr<Term>>,
+			StructuralOrder> expansions;
 	};
 
-	union stream_pointer {
-		std::istream*  i;
-		std::ostream*  o;
-		std::iostream* io;
+	std::map<std::string, macro> macros;
+
+	enum port_type {
+		INPUT,
+		OUTPUT,
+		BUFFER,
+		CLOSED,
+		GENERATOR
 	};
 
-	struct stream {
-		stream(std::istream* s) : type(ISTREAM) { pointer.i = s; }
-		stream(std::ostream* s) : type(OSTREAM) { pointer.o = s; }
-		stream(std::iostream* s) : type(IOSTREAM) { pointer.io = s; }
-		stream_type type;
-		stream_pointer pointer;
+	struct port {
+		port(std::istream* s)
+			: type(INPUT), input(s), output(nullptr), consumed(0) {}
+		port(std::ostream* s)
+			: type(OUTPUT), input(nullptr), output(s), consumed(0) {}
+		port_type type;
+		std::istream* input;
+		std::ostream* output;
+		std::unique_ptr<std::ios> file;
+		std::string buffer;
+		/// Bytes of a generated chunk already read from the buffer.
+		std::size_t consumed;
+		std::unique_ptr<Generator> generator;
 	};
 
-	std::vector<stream> ports;
+	std::vector<port> ports;
+
+	uint32_t add_port(port);
+	port& get_port(uint32_t);
+	Generator produce(std::shared_ptr<Term>, std::shared_ptr<Term>);
+	bool generate(uint32_t);
+	bool is_constant_body(std::shared_ptr<Term>);
+	bool fold(const std::string&);
+	static uint64_t next_generation();
 
 public:
 
 	Context();
+	Context(const Context*, std::size_t);
+
+	void import(const Context&);
 
 	void define_word(std::shared_ptr<Term>, std::shared_ptr<Term>);
 	void define_token(std::shared_ptr<Term>);
+	void define_macro(std::shared_ptr<Term>, std::shared_ptr<Term>);
+	void require(std::shared_ptr<Term>);
+	bool is_macro(std::shared_ptr<Term>) const;
+	const std::vector<std::shared_ptr<Term>>& expand_macro
+		(std::shared_ptr<Term>, std::shared_ptr<Term>);
+
+	uint32_t open_input(std::shared_ptr<Term>);
+	uint32_t open_output(std::shared_ptr<Term>);
+	uint32_t open_buffer();
+	uint32_t open_generator(std::shared_ptr<Term>, std::shared_ptr<Term>);
+	void close_port(uint32_t);
+	void put(uint32_t, uint32_t);
+	void put(uint32_t, const std::vector<uint32_t>&);
+	void put(uint32_t, const std::string&);
+	std::shared_ptr<Term> read(uint32_t, std::size_t);
+	std::shared_ptr<Term> contents(uint32_t);
 
 	std::istream& get_input_port(uint32_t);
 	std::ostream& get_output_port(uint32_t);
 	std::shared_ptr<Term> get_word(std::shared_ptr<Term>);
+	std::shared_ptr<Term> get_constant(std::shared_ptr<Term>);
+	void set_verbose(bool);
+	uint64_t get_generation() const;
+	void count_lookup(bool);
+	void print_statistics(std::ostream&) const;
+	void set_limits(const limits&);
+	void step();
+	void check_files() const;
+	void enter();
+	void leave();
+	void reserve(std::size_t);
+	Usage track();
+	bool is_worker() const;
+	void set_optimized(bool);
+	bool is_optimized() const;
+	void set_trace(Trace*);
+	void record(int64_t, std::size_t);
+	const std::string* name_source(const std::string&);
+	void locate(const std::shared_ptr<Term>&, const Position&);
+	void rethrow_located(const Term&, const std::runtime_error&) const;
+	void merge(const Context&);
 
 	std::shared_ptr<Term> pop();
 	void push(std::shared_ptr<Term>);
 	std::shared_ptr<Term> top() const;
+	std::size_t size() const;
 
 	std::vector<std::string>::const_iterator tokens_begin() const;
 	std::vector<std::string>::const_iterator tokens_end() const;
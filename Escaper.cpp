@@ -0,0 +1,228 @@
+/**
+ * @file Escaper.cpp
+ */
+#include "Escaper.h"
+#include <cstdint>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Constructs an escaper for the given kind of content.
+ */
+Escaper::Escaper(Kind kind) : kind(kind) {}
+
+/**
+ * Appends the escaped form of some text to the output.
+ */
+void Escaper::operator()(const std::string& input, std::string& output) const {
+	auto i = input.data(), end = i + input.size();
+	if (kind == CSS && i != end) {
+		// A CSS identifier cannot begin with a digit, or with - and a digit.
+		if (*i == '-' && end - i > 1 && i[1] >= '0' && i[1] <= '9') {
+			output += '-';
+			i = escape(i + 1, end, output);
+		} else if (*i >= '0' && *i <= '9') {
+			i = escape(i, end, output);
+		}
+	}
+	while (i != end) {
+		auto run = skip_clean(i, end);
+		output.append(i, run);
+		if (run == end) break;
+		i = escape(run, end, output);
+	}
+}
+
+/**
+ * Tests whether the character beginning at a byte must be escaped. Only URLs
+ * escape characters beyond ASCII, except that JavaScript escapes U+2028 and
+ * U+2029, which end a line there.
+ */
+bool Escaper::needs_escape(const char* i, const char* end) const {
+	auto c = static_cast<unsigned char>(*i);
+	switch (kind) {
+	case HTML:
+		return c == '&' || c == '<' || c == '>' || c == '"' || c == '\'';
+	case ATTRIBUTE:
+		return c < 0x80 && !(c >= 'a' && c <= 'z') && !(c >= 'A' && c <= 'Z')
+			&& !(c >= '0' && c <= '9') && c != ',' && c != '.' && c != '-'
+			&& c != '_';
+	case JAVASCRIPT:
+		if (c == 0xE2)
+			return end - i >= 3 && i[1] == '\x80'
+				&& (i[2] == '\xA8' || i[2] == '\xA9');
+		return c < 0x20 || c == 0x7F || c == '\\' || c == '"' || c == '\''
+			|| c == '<' || c == '>' || c == '&';
+	case CSS:
+		return c < 0x80 && !(c >= 'a' && c <= 'z') && !(c >= 'A' && c <= 'Z')
+			&& !(c >= '0' && c <= '9') && c != '-' && c != '_';
+	case URL:
+		return !(c >= 'a' && c <= 'z') && !(c >= 'A' && c <= 'Z')
+			&& !(c >= '0' && c <= '9') && c != '-' && c != '_' && c != '.'
+			&& c != '~';
+	}
+	return true;
+}
+
+#ifdef __SSE2__
+/**
+ * Matches bytes within an inclusive ASCII range. Bytes are compared as signed,
+ * so those of non-ASCII characters, being negative, never match.
+ */
+static inline __m128i in_range(__m128i c, char low, char high) {
+	return _mm_and_si128(
+		_mm_cmpgt_epi8(c, _mm_set1_epi8(low - 1)),
+		_mm_cmplt_epi8(c, _mm_set1_epi8(high + 1)));
+}
+
+/**
+ * Matches bytes equal to a given byte.
+ */
+static inline __m128i equal(__m128i c, char value) {
+	return _mm_cmpeq_epi8(c, _mm_set1_epi8(value));
+}
+
+/**
+ * Matches ASCII letters and digits.
+ */
+static inline __m128i alphanumeric(__m128i c) {
+	return _mm_or_si128(
+		_mm_or_si128(in_range(c, 'a', 'z'), in_range(c, 'A', 'Z')),
+		in_range(c, '0', '9'));
+}
+
+/**
+ * Matches the characters that HTML text treats specially.
+ */
+static inline __m128i html_special(__m128i c) {
+	return _mm_or_si128(
+		_mm_or_si128(equal(c, '&'), equal(c, '<')),
+		_mm_or_si128(_mm_or_si128(equal(c, '>'), equal(c, '"')),
+			equal(c, '\'')));
+}
+#endif
+
+/**
+ * Marks, one bit to a byte, those of a block of sixteen that may begin a
+ * character needing escape. May mark bytes that do not, which needs_escape()
+ * then settles one at a time.
+ */
+unsigned Escaper::block_marks(const char* block,
+	[[maybe_unused]] const char* end) const {
+#ifdef __SSE2__
+	auto c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+	auto all = _mm_set1_epi8(-1);
+	__m128i marked;
+	switch (kind) {
+	case HTML:
+		marked = html_special(c);
+		break;
+	case ATTRIBUTE:
+	case CSS:
+		marked = _mm_andnot_si128(_mm_or_si128(alphanumeric(c),
+			_mm_cmplt_epi8(c, _mm_setzero_si128())), all);
+		break;
+	case URL:
+		marked = _mm_andnot_si128(alphanumeric(c), all);
+		break;
+	case JAVASCRIPT:
+		marked = _mm_or_si128(
+			_mm_or_si128(html_special(c), equal(c, '\\')),
+			_mm_or_si128(
+				_mm_or_si128(in_range(c, 0, 0x1F), equal(c, 0x7F)),
+				equal(c, '\xE2')));
+		break;
+	default:
+		return 0xFFFF;
+	}
+	return _mm_movemask_epi8(marked);
+#else
+	unsigned marks = 0;
+	for (int i = 0; i < 16; ++i)
+		if (needs_escape(block + i, end))
+			marks |= 1u << i;
+	return marks;
+#endif
+}
+
+/**
+ * Finds the first byte in [begin, end) that begins a character needing escape.
+ */
+const char* Escaper::skip_clean(const char* begin, const char* end) const {
+	auto i = begin;
+	while (end - i >= 16) {
+		for (auto marks = block_marks(i, end); marks; marks &= marks - 1) {
+			auto marked = i + __builtin_ctz(marks);
+			if (needs_escape(marked, end))
+				return marked;
+		}
+		i += 16;
+	}
+	while (i != end && !needs_escape(i, end))
+		++i;
+	return i;
+}
+
+/**
+ * Appends the escaped form of the character beginning at a byte to the
+ * output, returning the byte after it.
+ */
+const char* Escaper::escape(const char* i, const char* end,
+	std::string& output) const {
+	static const char digits[] = "0123456789ABCDEF";
+	uint32_t c = static_cast<unsigned char>(*i++);
+	switch (kind) {
+	case HTML:
+		switch (c) {
+		case '&':  output += "&amp;";  break;
+		case '<':  output += "&lt;";   break;
+		case '>':  output += "&gt;";   break;
+		case '"':  output += "&quot;"; break;
+		default:   output += "&#39;";  break;
+		}
+		break;
+	case ATTRIBUTE:
+		output += "&#x";
+		if (c >= 0x10) output += digits[c >> 4];
+		output += digits[c & 0xF];
+		output += ';';
+		break;
+	case JAVASCRIPT:
+		switch (c) {
+		case '\\': output += "\\\\"; break;
+		case '"':  output += "\\\""; break;
+		case '\'': output += "\\'";  break;
+		case '\n': output += "\\n";  break;
+		case '\r': output += "\\r";  break;
+		case '\t': output += "\\t";  break;
+		default:
+			if (c == 0xE2 && end - i >= 2) {
+				// U+2028 or U+2029, as needs_escape() has checked.
+				c = 0x2000 | (static_cast<unsigned char>(i[1]) & 0x3F);
+				i += 2;
+			}
+			output += "\\u";
+			for (int shift = 12; shift >= 0; shift -= 4)
+				output += digits[(c >> shift) & 0xF];
+			break;
+		}
+		break;
+	case CSS:
+		output += '\\';
+		if (c == 0) {
+			output += "FFFD";
+		} else {
+			if (c >= 0x10) output += digits[c >> 4];
+			output += digits[c & 0xF];
+		}
+		output += ' ';
+		break;
+	case URL:
+		output += '%';
+		output += digits[c >> 4];
+		output += digits[c & 0xF];
+		break;
+	}
+	return i;
+}
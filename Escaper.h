@@ -0,0 +1,33 @@
+/**
+ * @file Escaper.h
+ */
+#ifndef ESCAPER_H
+#define ESCAPER_H
+#include <string>
+
+/**
+ * Escapes UTF-8 text for embedding in web content. Whether a character needs
+ * escaping can be told from its leading byte, so the bytes are scanned sixteen
+ * at a time without decoding, and each run that needs no escaping is copied
+ * through in a single append.
+ */
+class Escaper {
+public:
+	enum Kind {
+		HTML,
+		ATTRIBUTE,
+		JAVASCRIPT,
+		CSS,
+		URL
+	};
+	Escaper(Kind);
+	void operator()(const std::string&, std::string&) const;
+private:
+	Kind kind;
+	bool needs_escape(const char*, const char*) const;
+	unsigned block_marks(const char*, const char*) const;
+	const char* skip_clean(const char*, const char*) const;
+	const char* escape(const char*, const char*, std::string&) const;
+};
+
+#endif
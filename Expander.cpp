@@ -1,12 +1,15 @@
 #include "Expander.h"
 #include "Context.h"
 #include "Parser.h"
+#include <stdexcept>
 
 Expander::Expander(Parser& stack, Context& context)
 	: source(stack), context(context) {}
 
 bool Expander::empty() const {
-	return buffer.empty() && source.empty();
+	if (!buffer.empty()) return false;
+	read();
+	return buffer.empty();
 }
 
 void Expander::pop() {
@@ -20,14 +23,42 @@ std::shared_ptr<Term> Expander::top() const {
 }
 
 void Expander::read() const {
-	if (source.empty()) return;
-	if (*source.top() == Term("_token")) {
-		context.define_token(buffer.back());
-		buffer.pop_back();
-		buffer.push_back(source.top());
+	while (!source.empty()) {
+		auto term = source.top();
 		source.pop();
+		// Only a name can precede _token, so look ahead only past one. Looking
+		// past a word would tokenize the next Term before the word has run,
+		// and a token defined by a required module would apply one Term late.
+		if ((term->type == Term::STRING
+			|| (term->type == Term::SPECIAL && term->tag == Term::ARRAY))
+			&& !source.empty() && *source.top() == Term("_token")) {
+			context.define_token(term);
+			source.pop();
+			continue;
+		}
+		if (term->type == Term::SPECIAL && term->tag == Term::SYMBOL
+			&& context.is_macro(term)) {
+			if (source.empty())
+				throw std::runtime_error("Expected macro argument before EOF.");
+			auto argument = source.top();
+			source.pop();
+			// Expansions are cached, so count one step for each, or a macro
+			// that expands to itself would never reach the step limit.
+			context.step();
+			const auto& expansion = context.expand_macro(term, argument);
+			for (auto i = expansion.rbegin(); i != expansion.rend(); ++i)
+				source.push(*i);
+			continue;
+		}
+		if (term->type == Term::SPECIAL && term->tag == Term::SYMBOL) {
+			if (auto constant = context.get_constant(term)) {
+				buffer.insert(buffer.end(),
+					constant->values.begin(), constant->values.end());
+				if (!buffer.empty()) return;
+				continue;
+			}
+		}
+		buffer.push_back(term);
+		return;
 	}
-	if (source.empty()) return;
-	buffer.push_back(source.top());
-	source.pop();
 }
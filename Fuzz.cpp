@@ -0,0 +1,139 @@
+/**
+ * @file Fuzz.cpp
+ *
+ * Entry points for coverage-guided fuzzing with libFuzzer. Building every
+ * source file with -DVERY_FUZZ and -fsanitize=fuzzer yields a fuzzer for the
+ * Reader, Tokenizer, Parser, and Expander; adding -DVERY_FUZZ_EVALUATE fuzzes
+ * full evaluation instead. Inputs run under tight limits with files disabled
+ * and output discarded, so a slow or looping input is reported as an error
+ * rather than a timeout. With -DVERY_FUZZ_STANDALONE instead of
+ * -fsanitize=fuzzer, a main() runs the inputs given on the command line
+ * repeatedly and reports executions per second, failing if the rate falls
+ * below the one given by --min-rate, to catch throughput regressions.
+ *
+ * The corpus directory beside this file seeds both: pass it to libFuzzer as
+ * its corpus, and the standalone main() measures it when given no inputs.
+ * Its programs cover strings with escapes, nested comments, tokens, macros
+ * (including macros used inside definitions), and deep nesting.
+ * VERY_FUZZ_CORPUS overrides its path, which is relative to the working
+ * directory.
+ */
+#ifdef VERY_FUZZ
+#include "very.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef VERY_FUZZ_CORPUS
+#define VERY_FUZZ_CORPUS "corpus"
+#endif
+
+/**
+ * Discards the output of fuzzed programs.
+ */
+extern "C" int LLVMFuzzerInitialize(int*, char***) {
+	std::cout.rdbuf(nullptr);
+	return 0;
+}
+
+/**
+ * Runs one input, accepting any error that Very reports as such. Anything
+ * else, such as a crash, a hang, or a stray exception, is a finding.
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, std::size_t size) {
+	std::istringstream stream
+		(std::string(reinterpret_cast<const char*>(data), size));
+	Context::limits limits;
+	limits.steps = 100000;
+	limits.memory = 64 << 20;
+	limits.stack = 10000;
+	limits.depth = 1000;
+	limits.files = false;
+	Context context;
+	context.set_limits(limits);
+	try {
+#ifdef VERY_FUZZ_EVALUATE
+		evaluate(stream, context, false);
+#else
+		auto usage = context.track();
+		Reader reader(stream);
+		Tokenizer tokenizer(reader, context);
+		Parser parser(tokenizer, context);
+		Expander expander(parser, context);
+		force(expander);
+#endif
+	} catch (const std::runtime_error&) {
+	}
+	return 0;
+}
+
+#ifdef VERY_FUZZ_STANDALONE
+
+/**
+ * Runs the inputs named on the command line, or the files in the named
+ * directories, for about a second each and reports the rate of execution.
+ * With no inputs named, runs the seed corpus.
+ */
+int main(int argc, char** argv) {
+	double minimum = 0;
+	std::vector<std::string> paths;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--min-rate") == 0 && i + 1 < argc)
+			minimum = std::atof(argv[++i]);
+		else
+			paths.push_back(argv[i]);
+	}
+	if (paths.empty())
+		paths.push_back(VERY_FUZZ_CORPUS);
+	std::vector<std::string> inputs;
+	for (auto i = paths.begin(); i != paths.end(); ++i) {
+		if (std::filesystem::is_directory(*i)) {
+			for (const auto& entry : std::filesystem::directory_iterator(*i))
+				inputs.push_back(entry.path().string());
+		} else {
+			inputs.push_back(*i);
+		}
+	}
+	LLVMFuzzerInitialize(&argc, &argv);
+	std::vector<std::string> contents;
+	for (auto i = inputs.begin(); i != inputs.end(); ++i) {
+		std::ifstream file(*i, std::ios::binary);
+		if (!file) {
+			std::cerr << "Unable to open input \"" << *i << "\".\n";
+			return 1;
+		}
+		contents.emplace_back(std::istreambuf_iterator<char>(file),
+			std::istreambuf_iterator<char>());
+	}
+	if (contents.empty()) {
+		std::cerr << "No inputs.\n";
+		return 1;
+	}
+	typedef std::chrono::steady_clock clock;
+	uint64_t executions = 0;
+	auto start = clock::now();
+	auto elapsed = clock::duration::zero();
+	while (elapsed < std::chrono::seconds(1) * contents.size()) {
+		for (auto i = contents.begin(); i != contents.end(); ++i)
+			LLVMFuzzerTestOneInput
+				(reinterpret_cast<const uint8_t*>(i->data()), i->size());
+		executions += contents.size();
+		elapsed = clock::now() - start;
+	}
+	auto rate = executions
+		/ std::chrono::duration<double>(elapsed).count();
+	std::cerr << executions << " executions, " << uint64_t(rate)
+		<< " per second\n";
+	return rate < minimum ? 1 : 0;
+}
+
+#endif
+#endif
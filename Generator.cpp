@@ -0,0 +1,97 @@
+/**
+ * @file Generator.cpp
+ */
+#include "Generator.h"
+#include <stdexcept>
+#include <utility>
+
+/**
+ * Wraps a new coroutine.
+ */
+Generator Generator::promise_type::get_return_object() {
+	return Generator
+		(std::coroutine_handle<promise_type>::from_promise(*this));
+}
+
+/**
+ * Suspends a new coroutine, so that it does no work until first asked.
+ */
+std::suspend_always Generator::promise_type::initial_suspend() noexcept {
+	return {};
+}
+
+/**
+ * Suspends a finished coroutine, so that its Generator can see it is done.
+ */
+std::suspend_always Generator::promise_type::final_suspend() noexcept {
+	return {};
+}
+
+/**
+ * Hands a chunk to the consumer and suspends until it asks for another.
+ */
+std::suspend_always Generator::promise_type::yield_value(std::string value) {
+	chunk = std::move(value);
+	return {};
+}
+
+/**
+ * Ends the stream.
+ */
+void Generator::promise_type::return_void() {}
+
+/**
+ * Ends the stream, keeping the error to be raised in the consumer.
+ */
+void Generator::promise_type::unhandled_exception() {
+	error = std::current_exception();
+}
+
+/**
+ * Takes ownership of a coroutine.
+ */
+Generator::Generator(std::coroutine_handle<promise_type> handle)
+	: handle(handle), running(false) {}
+
+/**
+ * Moves a Generator, leaving the source without a coroutine.
+ */
+Generator::Generator(Generator&& other) noexcept
+	: handle(std::exchange(other.handle, nullptr)), running(other.running) {}
+
+/**
+ * Releases the coroutine and anything it still holds.
+ */
+Generator::~Generator() {
+	if (handle)
+		handle.destroy();
+}
+
+/**
+ * Resumes the coroutine until it yields its next chunk. Yields false once the
+ * stream has ended, and raises any error that ended it.
+ */
+bool Generator::next(std::string& chunk) {
+	if (running)
+		throw std::runtime_error("A generator cannot read its own port.");
+	if (!handle || handle.done())
+		return false;
+	running = true;
+	handle.resume();
+	running = false;
+	auto& promise = handle.promise();
+	if (promise.error)
+		std::rethrow_exception(std::exchange(promise.error, nullptr));
+	if (handle.done())
+		return false;
+	chunk = std::move(promise.chunk);
+	return true;
+}
+
+/**
+ * Tests whether the coroutine is in progress, and so cannot be resumed or
+ * destroyed.
+ */
+bool Generator::is_running() const {
+	return running;
+}
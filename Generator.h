@@ -0,0 +1,39 @@
+/**
+ * @file Generator.h
+ */
+#ifndef GENERATOR_H
+#define GENERATOR_H
+#include <coroutine>
+#include <exception>
+#include <string>
+
+/**
+ * A stream of text produced on demand by a coroutine. The coroutine runs only
+ * when its consumer asks for the next chunk, and suspends again as soon as it
+ * yields one, so neither side holds more than a chunk of the stream.
+ */
+class Generator {
+public:
+	struct promise_type {
+		std::string chunk;
+		std::exception_ptr error;
+		Generator get_return_object();
+		std::suspend_always initial_suspend() noexcept;
+		std::suspend_always final_suspend() noexcept;
+		std::suspend_always yield_value(std::string);
+		void return_void();
+		void unhandled_exception();
+	};
+	Generator(Generator&&) noexcept;
+	Generator(const Generator&) = delete;
+	Generator& operator=(const Generator&) = delete;
+	~Generator();
+	bool next(std::string&);
+	bool is_running() const;
+private:
+	explicit Generator(std::coroutine_handle<promise_type>);
+	std::coroutine_handle<promise_type> handle;
+	bool running;
+};
+
+#endif
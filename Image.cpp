@@ -0,0 +1,379 @@
+/**
+ * @file Image.cpp
+ */
+#include "Image.h"
+#include "Bignum.h"
+#include "Context.h"
+#include "Term.h"
+#include "Text.h"
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <utf8.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+/// Identifies an image file and the layout of its Terms.
+const char magic[8] = { 'V', 'E', 'R', 'Y', 'I', 'M', 'G', '1' };
+
+/// Changes whenever the encoding or the numbering of builtins changes.
+const uint32_t version = 1;
+
+/// Marks a Term that has already been written, by index.
+const uint8_t reference = 0xFF;
+
+}
+
+/**
+ * Encodes Terms, writing each shared Term once and referring back to it
+ * thereafter.
+ */
+class Image::Writer {
+	std::string& output;
+	std::map<const Term*, uint32_t> written;
+	bool node(const Term&);
+public:
+	Writer(std::string& output) : output(output) {}
+	template<class T> void scalar(T);
+	void string(const std::string&);
+	void term(const std::shared_ptr<Term>&);
+};
+
+/**
+ * Appends a fixed-size value.
+ */
+template<class T>
+void Image::Writer::scalar(T value) {
+	output.append(reinterpret_cast<const char*>(&value), sizeof value);
+}
+
+/**
+ * Appends a length-prefixed string.
+ */
+void Image::Writer::string(const std::string& value) {
+	scalar(uint32_t(value.size()));
+	output += value;
+}
+
+/**
+ * Appends a Term but not its elements, or a reference to it if it has already
+ * been written. Yields whether its elements must follow.
+ */
+bool Image::Writer::node(const Term& value) {
+	auto existing = written.find(&value);
+	if (existing != written.end()) {
+		scalar(reference);
+		scalar(existing->second);
+		return false;
+	}
+	written.insert(std::make_pair(&value, uint32_t(written.size())));
+	scalar(uint8_t(value.type));
+	switch (value.type) {
+	case Term::SCALAR:
+		scalar(value.tag);
+		break;
+	case Term::REAL:
+		scalar(value.real);
+		break;
+	case Term::BIGNUM:
+		{
+			std::ostringstream digits;
+			digits << *value.big;
+			string(digits.str());
+			break;
+		}
+	case Term::STRING:
+		string(value.text->data());
+		break;
+	case Term::SPECIAL:
+		scalar(value.tag);
+		if (value.tag == Term::SYMBOL)
+			string(value.text->data());
+		scalar(uint32_t(value.values.size()));
+		return !value.values.empty();
+	}
+	return false;
+}
+
+/**
+ * Appends a Term in preorder. Arrays still being written are kept on an
+ * explicit stack, so nesting is bounded only by memory.
+ */
+void Image::Writer::term(const std::shared_ptr<Term>& root) {
+	std::vector<std::pair<const Term*, std::size_t>> open;
+	const Term* value = root.get();
+	while (true) {
+		if (node(*value))
+			open.emplace_back(value, 0);
+		while (!open.empty()
+			&& open.back().second == open.back().first->values.size())
+			open.pop_back();
+		if (open.empty())
+			return;
+		value = open.back().first->values[open.back().second++].get();
+	}
+}
+
+/**
+ * Decodes Terms from a mapped image. Terms hold reference counts and are
+ * changed in place by their sole owners, so they cannot live in the read-only
+ * mapping itself; each is copied out of it once, and the mapping is released
+ * when loading is done.
+ */
+class Image::Loader {
+	const char* position;
+	const char* end;
+	std::vector<std::shared_ptr<Term>> loaded;
+	std::vector<bool> finished;
+	std::shared_ptr<Term> node(uint32_t&);
+public:
+	Loader(const char* begin, const char* end)
+		: position(begin), end(end) {}
+	template<class T> T scalar();
+	std::string string();
+	std::shared_ptr<Term> term();
+	bool done() const { return position == end; }
+};
+
+/**
+ * Reads a fixed-size value.
+ */
+template<class T>
+T Image::Loader::scalar() {
+	if (std::size_t(end - position) < sizeof(T))
+		throw std::runtime_error("Truncated image.");
+	T value;
+	std::memcpy(&value, position, sizeof value);
+	position += sizeof value;
+	return value;
+}
+
+/**
+ * Reads a length-prefixed string. Strings become names and Texts, which must
+ * be valid UTF-8, so an invalid one is reported here as an invalid image
+ * rather than later as an encoding error.
+ */
+std::string Image::Loader::string() {
+	auto size = scalar<uint32_t>();
+	if (std::size_t(end - position) < size)
+		throw std::runtime_error("Truncated image.");
+	std::string value(position, size);
+	position += size;
+	if (!utf8::is_valid(value.begin(), value.end()))
+		throw std::runtime_error("Invalid image.");
+	return value;
+}
+
+/**
+ * Reads a Term but not its elements, giving the number of elements that
+ * follow. A reference must be to a Term whose elements have all been read, or
+ * the image could make an array contain itself.
+ */
+std::shared_ptr<Term> Image::Loader::node(uint32_t& size) {
+	size = 0;
+	auto type = scalar<uint8_t>();
+	if (type == reference) {
+		auto index = scalar<uint32_t>();
+		if (index >= loaded.size() || !finished[index])
+			throw std::runtime_error("Invalid reference in image.");
+		return loaded[index];
+	}
+	auto value = std::make_shared<Term>();
+	loaded.push_back(value);
+	finished.push_back(false);
+	switch (type) {
+	case Term::SCALAR:
+		value->type = Term::SCALAR;
+		value->tag = scalar<int64_t>();
+		break;
+	case Term::REAL:
+		value->type = Term::REAL;
+		value->real = scalar<double>();
+		break;
+	case Term::BIGNUM:
+		value->type = Term::BIGNUM;
+		value->tag = 0;
+		value->big = std::make_shared<const Bignum>(Bignum(string()));
+		break;
+	case Term::STRING:
+		value->type = Term::STRING;
+		value->tag = 0;
+		value->text = std::make_shared<Text>(string());
+		break;
+	case Term::SPECIAL:
+		value->tag = scalar<int64_t>();
+		if (value->tag < 0 || uint64_t(value->tag) >= Term::operation_count())
+			throw std::runtime_error("Invalid builtin in image.");
+		if (value->tag == Term::SYMBOL)
+			value->text = std::make_shared<Text>(string());
+		size = scalar<uint32_t>();
+		// Every element takes at least five bytes, as a reference.
+		if (size > std::size_t(end - position) / 5)
+			throw std::runtime_error("Truncated image.");
+		value->values.reserve(size);
+		break;
+	default:
+		throw std::runtime_error("Invalid Term in image.");
+	}
+	finished.back() = !size;
+	return value;
+}
+
+/**
+ * Reads a Term in preorder. Arrays still being filled are kept on an explicit
+ * stack with the number of elements each still needs, so nesting is bounded
+ * only by the size of the image.
+ */
+std::shared_ptr<Term> Image::Loader::term() {
+	std::vector<std::pair<std::size_t, uint32_t>> open;
+	std::shared_ptr<Term> root;
+	do {
+		uint32_t size;
+		auto value = node(size);
+		if (open.empty()) {
+			root = value;
+		} else {
+			loaded[open.back().first]->values.push_back(value);
+			--open.back().second;
+		}
+		if (size)
+			open.emplace_back(loaded.size() - 1, size);
+		while (!open.empty() && !open.back().second) {
+			finished[open.back().first] = true;
+			open.pop_back();
+		}
+	} while (!open.empty());
+	return root;
+}
+
+/**
+ * Writes an image of a Context to a file. File and generator ports cannot be
+ * saved, since they refer to state outside the image.
+ */
+void Image::save(const Context& context, const std::string& path) {
+	std::string output(magic, sizeof magic);
+	Writer writer(output);
+	writer.scalar(version);
+
+	writer.scalar(uint32_t(context.words.size()));
+	for (auto i = context.words.begin(); i != context.words.end(); ++i) {
+		writer.string(i->first);
+		writer.scalar(uint8_t(context.constants.count(i->first) ? 2
+			: context.unfolded.count(i->first) ? 1 : 0));
+		writer.term(i->second);
+	}
+
+	writer.scalar(uint32_t(context.tokens.size()));
+	for (auto i = context.tokens.begin(); i != context.tokens.end(); ++i)
+		writer.string(*i);
+
+	writer.scalar(uint32_t(context.macros.size()));
+	for (auto i = context.macros.begin(); i != context.macros.end(); ++i) {
+		writer.string(i->first);
+		writer.term(i->second.body);
+	}
+
+	writer.scalar(uint32_t(context.terms.size()));
+	for (auto i = context.terms.begin(); i != context.terms.end(); ++i)
+		writer.term(*i);
+
+	writer.scalar(uint32_t(context.ports.size()));
+	for (std::size_t i = 0; i < context.ports.size(); ++i) {
+		const auto& port = context.ports[i];
+		if (i >= 3 && (port.type == Context::INPUT
+			|| port.type == Context::OUTPUT
+			|| port.type == Context::GENERATOR))
+			throw std::runtime_error
+				("Close file and generator ports before saving an image.");
+		writer.scalar(uint8_t(port.type));
+		if (port.type == Context::BUFFER)
+			writer.string(port.buffer);
+	}
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file.write(output.data(), output.size()))
+		throw std::runtime_error("Unable to write image.");
+}
+
+/**
+ * Replaces the state of a Context with an image read from a file.
+ */
+void Image::load(Context& context, const std::string& path) {
+#if defined(__unix__) || defined(__APPLE__)
+	int descriptor = ::open(path.c_str(), O_RDONLY);
+	struct stat status;
+	if (descriptor < 0 || ::fstat(descriptor, &status) < 0) {
+		if (descriptor >= 0) ::close(descriptor);
+		throw std::runtime_error("Unable to open image.");
+	}
+	std::size_t size = status.st_size;
+	void* mapping = size ? ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE,
+		descriptor, 0) : MAP_FAILED;
+	::close(descriptor);
+	if (mapping == MAP_FAILED)
+		throw std::runtime_error("Unable to map image.");
+	std::shared_ptr<void> unmap(mapping,
+		[size](void* address) { ::munmap(address, size); });
+	const char* begin = static_cast<const char*>(mapping);
+#else
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		throw std::runtime_error("Unable to open image.");
+	std::string contents((std::istreambuf_iterator<char>(file)),
+		std::istreambuf_iterator<char>());
+	std::size_t size = contents.size();
+	const char* begin = contents.data();
+#endif
+	if (size < sizeof magic || std::memcmp(begin, magic, sizeof magic) != 0)
+		throw std::runtime_error("Not an image.");
+	Loader loader(begin + sizeof magic, begin + size);
+	if (loader.scalar<uint32_t>() != version)
+		throw std::runtime_error("Image was saved by a different version.");
+
+	context.words.clear();
+	context.generation = Context::next_generation();
+	context.unfolded.clear();
+	context.constants.clear();
+	for (auto count = loader.scalar<uint32_t>(); count--; ) {
+		auto name = loader.string();
+		auto state = loader.scalar<uint8_t>();
+		context.words[name] = loader.term();
+		if (state == 2) context.constants.insert(name);
+		if (state == 1) context.unfolded.insert(name);
+	}
+
+	context.tokens.clear();
+	for (auto count = loader.scalar<uint32_t>(); count--; )
+		context.tokens.push_back(loader.string());
+
+	context.macros.clear();
+	for (auto count = loader.scalar<uint32_t>(); count--; ) {
+		auto name = loader.string();
+		context.macros[name].body = loader.term();
+	}
+
+	context.terms.clear();
+	for (auto count = loader.scalar<uint32_t>(); count--; )
+		context.terms.push_back(loader.term());
+
+	auto count = loader.scalar<uint32_t>();
+	for (uint32_t i = 0; i < count; ++i) {
+		auto type = Context::port_type(loader.scalar<uint8_t>());
+		if (i < 3)
+			continue;
+		Context::port port(static_cast<std::istream*>(nullptr));
+		port.type = type == Context::BUFFER ? Context::BUFFER : Context::CLOSED;
+		if (type == Context::BUFFER)
+			port.buffer = loader.string();
+		context.ports.push_back(std::move(port));
+	}
+	if (!loader.done())
+		throw std::runtime_error("Trailing data in image.");
+}
@@ -0,0 +1,30 @@
+/**
+ * @file Image.h
+ */
+#ifndef IMAGE_H
+#define IMAGE_H
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Context;
+class Term;
+
+/**
+ * A snapshot of an evaluated Context: its words, tokens, macros, stack, and
+ * buffer ports. An image holds no pointers, so it can be mapped anywhere, and
+ * loading it is a single pass over the mapping that rebuilds its Terms with no
+ * lexing, parsing, or evaluation.
+ */
+class Image {
+public:
+	static void save(const Context&, const std::string&);
+	static void load(Context&, const std::string&);
+private:
+	class Writer;
+	class Loader;
+};
+
+#endif
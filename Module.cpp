@@ -0,0 +1,76 @@
+/**
+ * @file Module.cpp
+ */
+#include "Module.h"
+#include "very.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+/**
+ * Loads the module at a path, or reuses it if it is already loaded and its
+ * file is unchanged. The module is evaluated in its own Context, and the
+ * words it defines, including those it requires in turn, are recorded. It is
+ * held to what remains of the limits of the Context that requires it, which is
+ * charged for the steps and memory used to load it.
+ */
+std::shared_ptr<const Module> Module::load
+	(const std::string& name, Context& caller) {
+	static std::map<std::pair<std::filesystem::path, bool>,
+		std::shared_ptr<const Module>> cache;
+	static std::set<std::filesystem::path> loading;
+	static std::recursive_mutex mutex;
+	std::lock_guard<std::recursive_mutex> lock(mutex);
+
+	std::error_code error;
+	auto path = std::filesystem::weakly_canonical(name, error);
+	auto modified = std::filesystem::last_write_time(path, error);
+	if (error) {
+		std::ostringstream message;
+		message << "Unable to open module \"" << name << "\".";
+		throw std::runtime_error(message.str());
+	}
+	auto key = std::make_pair(path, caller.optimized);
+	auto existing = cache.find(key);
+	if (existing != cache.end() && existing->second->modified == modified)
+		return existing->second;
+	if (!loading.insert(path).second) {
+		std::ostringstream message;
+		message << "Module \"" << name << "\" requires itself.";
+		throw std::runtime_error(message.str());
+	}
+
+	std::shared_ptr<Module> module(new Module());
+	module->modified = modified;
+	auto& context = module->context;
+	context.limit = caller.limit;
+	context.limit.steps -= std::min(caller.steps, caller.limit.steps);
+	context.limit.memory -= std::min<std::size_t>
+		(std::max<int64_t>(caller.allocated, 0), caller.limit.memory);
+	context.limit.depth -= std::min(caller.depth, caller.limit.depth);
+	context.optimized = caller.optimized;
+	std::set<std::string> initial;
+	for (auto i = module->context.words.begin();
+		i != module->context.words.end(); ++i)
+		initial.insert(i->first);
+	try {
+		std::ifstream file(path);
+		if (!file)
+			throw std::runtime_error("Unable to open module.");
+		evaluate(file, context, false, name);
+	} catch (...) {
+		loading.erase(path);
+		throw;
+	}
+	loading.erase(path);
+	for (auto i = module->context.words.begin();
+		i != module->context.words.end(); ++i)
+		if (!initial.count(i->first))
+			module->defined.insert(i->first);
+	caller.merge(context);
+	cache[key] = module;
+	return module;
+}
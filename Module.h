@@ -0,0 +1,27 @@
+/**
+ * @file Module.h
+ */
+#ifndef MODULE_H
+#define MODULE_H
+#include "Context.h"
+#include <filesystem>
+#include <memory>
+#include <set>
+#include <string>
+
+/**
+ * A program evaluated once per process so that its definitions can be shared
+ * by every Context that requires it. Modules are cached by path and by whether
+ * they were optimized, and reloaded only if the file has been modified since.
+ */
+class Module {
+	friend class Context;
+	Context context;
+	std::set<std::string> defined;
+	std::filesystem::file_time_type modified;
+	Module() {}
+public:
+	static std::shared_ptr<const Module> load(const std::string&, Context&);
+};
+
+#endif
@@ -1,64 +1,117 @@
 #include "Parser.h"
+#include "Context.h"
 #include "Term.h"
 #include "Tokenizer.h"
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
 
 /**
  * Gets the first Term from the source.
  */
-Parser::Parser(Tokenizer& stack)
-	: source(new Tokenizer(stack)), buffer(new buffer_type()) {}
+Parser::Parser(Tokenizer& stack, Context& context)
+	: source(new Tokenizer(stack)), context(context) {}
 
 /**
  * End-of-range test.
  */
 bool Parser::empty() const {
-	return buffer->empty() && source->empty();
+	return buffer.empty() && source->empty();
 }
 
 /**
  * Removes the current Term.
  */
 void Parser::pop() {
-	if (buffer->empty()) read();
-	buffer->pop_front();
+	if (buffer.empty()) read();
+	buffer.pop_front();
 }
 
 /**
  * Ungets a Term.
  */
 void Parser::push(std::shared_ptr<Term> term) {
-	buffer->push_front(term);
+	buffer.push_front(term);
 }
 
 /**
  * Gets the current Term.
  */
 std::shared_ptr<Term> Parser::top() const {
-	if (buffer->empty()) read();
-	return buffer->front();
+	if (buffer.empty()) read();
+	return buffer.front();
 }
 
 /**
- * Reads a (possibly nested) Term from the source.
+ * Expands the macro uses among the elements of a list that has just closed.
+ * Its nested lists were expanded as they closed, so one pass suffices; each
+ * expansion is scanned again, as at the top level, in case it begins with a
+ * macro use of its own.
+ */
+void Parser::expand(Term& list) const {
+	auto is_macro = [this](const std::shared_ptr<Term>& term) {
+		return term->type == Term::SPECIAL && term->tag == Term::SYMBOL
+			&& context.is_macro(term);
+	};
+	auto first = std::find_if(list.values.begin(), list.values.end(), is_macro);
+	if (first == list.values.end()) return;
+	std::vector<std::shared_ptr<Term>> pending
+		(list.values.rbegin(), std::make_reverse_iterator(first));
+	list.values.erase(first, list.values.end());
+	auto& values = list.values;
+	while (!pending.empty()) {
+		auto term = std::move(pending.back());
+		pending.pop_back();
+		if (is_macro(term)) {
+			if (pending.empty())
+				throw std::runtime_error("Expected macro argument before ).");
+			auto argument = std::move(pending.back());
+			pending.pop_back();
+			context.step();
+			const auto& expansion = context.expand_macro(term, argument);
+			pending.insert(pending.end(), expansion.rbegin(), expansion.rend());
+			continue;
+		}
+		values.push_back(std::move(term));
+	}
+}
+
+/**
+ * Reads a (possibly nested) Term from the source. Open lists are kept on an
+ * explicit stack, so nesting depth costs no native stack and each token is
+ * released as soon as it has been attached to its list.
  */
 void Parser::read() const {
 	if (source->empty()) return;
-	std::shared_ptr<Term> term;
-	if (source->top() == "(") {
-		source->pop();
-		term.reset(new Term());
-		Parser stack(*this);
-		while (!source->empty() && source->top() != ")") {
-			term->values.push_back(stack.top());
-			stack.pop();
+	std::vector<std::shared_ptr<Term>> open;
+	Position outermost;
+	while (true) {
+		std::shared_ptr<Term> term;
+		if (source->top() == "(") {
+			if (open.empty())
+				outermost = source->position();
+			source->pop();
+			open.push_back(std::make_shared<Term>());
+		} else if (!open.empty() && source->top() == ")") {
+			source->pop();
+			term = open.back();
+			open.pop_back();
+			expand(*term);
+		} else {
+			term = std::make_shared<Term>(source->top());
+			if (term->type == Term::SPECIAL)
+				context.locate(term, source->position());
+			source->pop();
+		}
+		if (term) {
+			if (open.empty()) {
+				buffer.push_back(term);
+				return;
+			}
+			open.back()->values.push_back(term);
 		}
 		if (source->empty())
-			throw std::runtime_error("Expected ) before EOF.");
-		source->pop(); // )
-		buffer->push_back(term);
-		return;
+			throw LocatedError(outermost, "Expected ) before EOF.");
 	}
-	term.reset(new Term(source->top()));
-	source->pop();
-	buffer->push_back(term);
 }
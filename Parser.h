@@ -6,23 +6,29 @@
 #include <deque>
 #include <memory>
 
+class Context;
 class Term;
 class Tokenizer;
 
 /**
- * Parses a token sequence into terms.
+ * Parses a token sequence into terms. Holds at most one complete top-level
+ * Term at a time; nested lists are built in place as their tokens arrive, and
+ * the macro uses among a list's elements are expanded when the list closes.
+ * The positions of symbols and builtins are recorded in the Context for use in
+ * error messages.
  */
 class Parser {
 	std::shared_ptr<Tokenizer> source;
-	typedef std::deque<std::shared_ptr<Term>> buffer_type;
-	std::shared_ptr<buffer_type> buffer;
+	Context& context;
+	mutable std::deque<std::shared_ptr<Term>> buffer;
 public:
-	Parser(Tokenizer&);
+	Parser(Tokenizer&, Context&);
 	bool empty() const;
 	void pop();
 	void push(std::shared_ptr<Term>);
 	std::shared_ptr<Term> top() const;
 private:
+	void expand(Term&) const;
 	void read() const;
 };
 
@@ -0,0 +1,43 @@
+/**
+ * @file Position.h
+ */
+#ifndef POSITION_H
+#define POSITION_H
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+/**
+ * A line and column in source, both counted from 1, and the name of the
+ * source if it has one. The name is owned by the Context that read it.
+ */
+struct Position {
+	uint32_t line;
+	uint32_t column;
+	const std::string* source;
+	Position() : line(1), column(1), source(nullptr) {}
+	std::string describe(const std::string&) const;
+};
+
+/**
+ * An error whose message already gives its position in source.
+ */
+class LocatedError : public std::runtime_error {
+public:
+	LocatedError(const Position& position, const std::string& message)
+		: std::runtime_error(position.describe(message)) {}
+};
+
+/**
+ * Prefixes a message with the position.
+ */
+inline std::string Position::describe(const std::string& message) const {
+	std::ostringstream result;
+	if (source)
+		result << *source << ':';
+	result << line << ':' << column << ": " << message;
+	return result.str();
+}
+
+#endif
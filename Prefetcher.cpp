@@ -0,0 +1,107 @@
+/**
+ * @file Prefetcher.cpp
+ */
+#include "Prefetcher.h"
+#include <istream>
+#include <iterator>
+#include <utf8.h>
+
+/**
+ * Starts decoding the stream in the background.
+ */
+Prefetcher::Prefetcher(std::istream& stream)
+	: stream(stream), position(0), has_ready(false), finished(false),
+	stopping(false), thread(&Prefetcher::run, this) {}
+
+/**
+ * Stops the background thread. If it is blocked reading the stream, this waits
+ * for the read to complete.
+ */
+Prefetcher::~Prefetcher() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_all();
+	thread.join();
+}
+
+/**
+ * End-of-range test. Waits for the next block if the current one is drained.
+ */
+bool Prefetcher::empty() {
+	if (position != current.size()) return false;
+	std::unique_lock<std::mutex> lock(mutex);
+	condition.wait(lock, [this] { return has_ready || finished; });
+	if (!has_ready) {
+		if (error) std::rethrow_exception(error);
+		return true;
+	}
+	current.swap(ready);
+	position = 0;
+	has_ready = false;
+	lock.unlock();
+	condition.notify_all();
+	return false;
+}
+
+/**
+ * Removes the current character.
+ */
+void Prefetcher::pop() {
+	if (!empty()) ++position;
+}
+
+/**
+ * Gets the current character.
+ */
+uint32_t Prefetcher::top() {
+	empty();
+	return current[position];
+}
+
+/**
+ * Decodes blocks of characters and hands them to the reader one at a time. A
+ * block is handed over early once the stream has nothing more ready to read,
+ * so that input already received is not held back waiting for the rest.
+ */
+void Prefetcher::run() {
+	std::istreambuf_iterator<char> source(stream), end;
+	auto buffer = stream.rdbuf();
+	std::vector<uint32_t> block;
+	std::exception_ptr failure;
+	bool done = false;
+	while (!done) {
+		block.clear();
+		try {
+			while (block.size() != block_size) {
+				if (!block.empty() && buffer->in_avail() <= 0)
+					break;
+				if (source == end) {
+					done = true;
+					break;
+				}
+				block.push_back(utf8::next(source, end));
+			}
+		} catch (const utf8::exception&) {
+			failure = std::make_exception_ptr
+				(std::runtime_error("Invalid UTF-8 in input."));
+		} catch (...) {
+			failure = std::current_exception();
+		}
+		done = done || failure;
+		std::unique_lock<std::mutex> lock(mutex);
+		condition.wait(lock, [this] { return !has_ready || stopping; });
+		if (stopping) return;
+		if (!block.empty()) {
+			ready.swap(block);
+			has_ready = true;
+		}
+		if (done) {
+			error = failure;
+			finished = true;
+		}
+		lock.unlock();
+		condition.notify_all();
+	}
+}
@@ -0,0 +1,45 @@
+/**
+ * @file Prefetcher.h
+ */
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <iosfwd>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Decodes an input stream on a background thread. The thread fills one block
+ * of characters while the reader drains the other, and hands a block over
+ * early whenever the stream has nothing more ready, so a slow producer on the
+ * far side of a pipe does not stall evaluation of input already received.
+ */
+class Prefetcher {
+	static const std::size_t block_size = 4096;
+	std::istream& stream;
+	std::vector<uint32_t> current;
+	std::size_t position;
+	std::vector<uint32_t> ready;
+	bool has_ready;
+	bool finished;
+	bool stopping;
+	std::exception_ptr error;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::thread thread;
+public:
+	Prefetcher(std::istream&);
+	~Prefetcher();
+	Prefetcher(const Prefetcher&) = delete;
+	Prefetcher& operator=(const Prefetcher&) = delete;
+	bool empty();
+	void pop();
+	uint32_t top();
+private:
+	void run();
+};
+
+#endif
@@ -2,18 +2,27 @@
  * @file Reader.cpp
  */
 #include "Reader.h"
+#include <istream>
+#include <stdexcept>
 #include <utf8.h>
 
 /**
- * Gets the first character from the stream.
+ * Gets the first character from the stream, optionally decoding ahead on a
+ * background thread. Positions name the given source, if any.
  */
-Reader::Reader(std::istream& stream) : source(stream) {}
+Reader::Reader(std::istream& stream, bool prefetch, const std::string* name)
+	: source(prefetch ? std::istreambuf_iterator<char>() : stream),
+	prefetcher(prefetch ? new Prefetcher(stream) : nullptr) {
+	current.source = name;
+}
 
 /**
  * End-of-range test.
  */
 bool Reader::empty() const {
-	return buffer.empty() && source == std::istreambuf_iterator<char>();
+	if (!buffer.empty()) return false;
+	if (prefetcher) return prefetcher->empty();
+	return source == std::istreambuf_iterator<char>();
 }
 
 /**
@@ -21,6 +30,12 @@ bool Reader::empty() const {
  */
 void Reader::pop() {
 	if (buffer.empty()) read();
+	if (buffer.front() == '\n') {
+		++current.line;
+		current.column = 1;
+	} else {
+		++current.column;
+	}
 	buffer.pop_front();
 }
 
@@ -39,11 +54,28 @@ uint32_t Reader::top() const {
 	return buffer.front();
 }
 
+/**
+ * Gets the position of the current character.
+ */
+const Position& Reader::position() const {
+	return current;
+}
+
 /**
  * Reads and converts a character from the input stream.
  */
 void Reader::read() const {
+	if (prefetcher) {
+		if (prefetcher->empty()) return;
+		buffer.push_back(prefetcher->top());
+		prefetcher->pop();
+		return;
+	}
 	std::istreambuf_iterator<char> end;
 	if (source == end) return;
-	buffer.push_back(utf8::next(source, end));
+	try {
+		buffer.push_back(utf8::next(source, end));
+	} catch (const utf8::exception&) {
+		throw std::runtime_error("Invalid UTF-8 in input.");
+	}
 }
@@ -3,9 +3,13 @@
  */
 #ifndef READER_H
 #define READER_H
+#include "Position.h"
+#include "Prefetcher.h"
 #include <deque>
 #include <iosfwd>
 #include <iterator>
+#include <memory>
+#include <string>
 
 /**
  * Adapts an input stream into a stack.
@@ -13,12 +17,15 @@
 class Reader {
 	mutable std::istreambuf_iterator<char> source;
 	mutable std::deque<uint32_t> buffer;
+	std::unique_ptr<Prefetcher> prefetcher;
+	Position current;
 public:
-	Reader(std::istream&);
+	Reader(std::istream&, bool = false, const std::string* = nullptr);
 	bool empty() const;
 	void pop();
 	void push(uint32_t);
 	uint32_t top() const;
+	const Position& position() const;
 private:
 	void read() const;
 };
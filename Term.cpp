@@ -2,18 +2,34 @@
  * @file Term.cpp
  */
 #include "Term.h"
+#include "Bignum.h"
+#include "Code.h"
 #include "Context.h"
+#include "Escaper.h"
+#include "Text.h"
+#include "Usage.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
 #include <utility>
 #include <utf8.h>
 
 using namespace std::rel_ops;
 
 /// Map of builtin operations to their names.
-std::map<std::string, int32_t> Term::operations {
+std::map<std::string, int64_t> Term::operations {
 	{ "_def",    DEF },
+	{ "_macro",  MACRO },
 	{ "dup",     DUP },
 	{ "pop",     POP },
 	{ "swap",    SWAP },
@@ -33,57 +49,567 @@ std::map<std::string, int32_t> Term::operations {
 	{ "ge?",     GE },
 	{ "eq?",     EQ },
 	{ "ne?",     NE },
-	{ "cond",    COND }
+	{ "cond",    COND },
+	{ "open_input",  OPEN_INPUT },
+	{ "open_output", OPEN_OUTPUT },
+	{ "open_buffer", OPEN_BUFFER },
+	{ "close",       CLOSE },
+	{ "read",        READ },
+	{ "contents",    CONTENTS },
+	{ "length",  LENGTH },
+	{ "nth",     NTH },
+	{ "slice",   SLICE },
+	{ "reverse", REVERSE },
+	{ "map",     MAP },
+	{ "fold",    FOLD },
+	{ "filter",  FILTER },
+	{ "each",    EACH },
+	{ "escape_html",      ESCAPE_HTML },
+	{ "escape_attribute", ESCAPE_ATTRIBUTE },
+	{ "escape_js",        ESCAPE_JS },
+	{ "escape_css",       ESCAPE_CSS },
+	{ "escape_url",       ESCAPE_URL },
+	{ "real",     TO_REAL },
+	{ "truncate", TRUNCATE },
+	{ "string",   TO_STRING },
+	{ "chars",    TO_CHARS },
+	{ "pmap",     PMAP },
+	{ "require",  REQUIRE },
+	{ "open_generator", OPEN_GENERATOR }
 };
 
+/**
+ * Inverts the map of builtin operations, so that names can be found by index.
+ */
+static std::vector<std::string> invert
+	(const std::map<std::string, int64_t>& operations) {
+	std::vector<std::string> result;
+	for (auto i = operations.begin(); i != operations.end(); ++i) {
+		if (std::size_t(i->second) >= result.size())
+			result.resize(i->second + 1);
+		result[i->second] = i->first;
+	}
+	return result;
+}
+
+/// Names of builtin operations, indexed by Extra.
+std::vector<std::string> Term::names = invert(Term::operations);
+
 /**
  * Constructs an empty array Term.
  */
-Term::Term() : type(SPECIAL), tag(ARRAY) {}
+Term::Term()
+	: type(SPECIAL), tag(ARRAY), resolved(nullptr), resolved_generation(0),
+	charged(0), code_begin(0),
+	code_end(0) {
+	Usage::charge(sizeof(Term));
+}
 
 /**
  * Constructs a scalar Term.
  * @param value Scalar value.
  */
-Term::Term(int32_t value) : type(SCALAR), tag(value) {}
+Term::Term(int64_t value)
+	: type(SCALAR), tag(value), resolved(nullptr), resolved_generation(0),
+	charged(0), code_begin(0),
+	code_end(0) {
+	Usage::charge(sizeof(Term));
+}
+
+/**
+ * Constructs a string Term.
+ * @param value String value.
+ */
+Term::Term(std::shared_ptr<const Text> value)
+	: type(STRING), tag(0), text(value), resolved(nullptr),
+	resolved_generation(0), charged(0), code_begin(0),
+	code_end(0) {
+	Usage::charge(sizeof(Term));
+}
+
+/**
+ * Copies a Term, sharing its elements.
+ */
+Term::Term(const Term& other)
+	: std::enable_shared_from_this<Term>(), type(other.type),
+	big(other.big), text(other.text), values(other.values),
+	resolved(other.resolved), resolved_generation(other.resolved_generation),
+	charged(values.capacity()), code(other.code), enclosing(other.enclosing),
+	code_begin(other.code_begin), code_end(other.code_end) {
+	if (type == REAL)
+		real = other.real;
+	else
+		tag = other.tag;
+	Usage::charge(sizeof(Term) + charged * sizeof(std::shared_ptr<Term>));
+}
+
+/**
+ * Moves the Terms that this Term holds, in its elements and in a Code that
+ * only it owns, into a list to be released.
+ */
+void Term::detach(std::vector<std::shared_ptr<Term>>& pending) {
+	if (code && code.use_count() == 1) {
+		pending.insert(pending.end(), std::make_move_iterator
+			(code->values.begin()), std::make_move_iterator(code->values.end()));
+		code->values.clear();
+		code.reset();
+	}
+	pending.insert(pending.end(), std::make_move_iterator(values.begin()),
+		std::make_move_iterator(values.end()));
+	values.clear();
+}
+
+/**
+ * Releases a Term. Nested arrays that would be released with it are taken
+ * apart here, one at a time, so that releasing a deeply nested array cannot
+ * overflow the native stack.
+ */
+Term::~Term() {
+	Usage::charge
+		(-int64_t(sizeof(Term) + charged * sizeof(std::shared_ptr<Term>)));
+	bool nested = code && code.use_count() == 1;
+	for (auto i = values.begin(); !nested && i != values.end(); ++i)
+		nested = i->use_count() == 1 && (!(*i)->values.empty() || (*i)->code);
+	if (!nested)
+		return;
+	std::vector<std::shared_ptr<Term>> pending;
+	detach(pending);
+	while (!pending.empty()) {
+		auto term = std::move(pending.back());
+		pending.pop_back();
+		if (term.use_count() == 1)
+			term->detach(pending);
+	}
+}
+
+/**
+ * Brings the count of allocated bytes up to date with the capacity of this
+ * Term's elements.
+ */
+void Term::account() {
+	auto capacity = values.capacity();
+	if (capacity == charged)
+		return;
+	Usage::charge((int64_t(capacity) - int64_t(charged))
+		* int64_t(sizeof(std::shared_ptr<Term>)));
+	charged = capacity;
+}
+
+/**
+ * Tests whether a token is entirely a floating-point literal.
+ */
+static bool real_literal(const std::string& token) {
+	char* end;
+	std::strtod(token.c_str(), &end);
+	return end == token.c_str() + token.size();
+}
 
 /**
  * Constructs a Term from the given token string.
  */
-Term::Term(const std::string& token) {
+Term::Term(const std::string& token)
+	: resolved(nullptr), resolved_generation(0), charged(0), code_begin(0),
+	code_end(0) {
+	Usage::charge(sizeof(Term));
 	auto operation = operations.find(token);
 	if (operation != operations.end()) {
 		type = SPECIAL;
 		tag = operation->second;
+	} else if ((::isdigit(token[0]) || token[0] == '-' || token[0] == '+')
+		&& token.find_first_of(".eE") != std::string::npos
+		&& real_literal(token)) {
+		type = REAL;
+		real = std::strtod(token.c_str(), nullptr);
 	} else if (::isdigit(token[0]) || token[0] == '-' || token[0] == '+') {
 		std::istringstream stream(token);
 		type = SCALAR;
-		stream >> tag;
+		if (!(stream >> tag) && token.find_first_not_of
+			("0123456789", 1) == std::string::npos)
+			assign(Bignum(token));
 	} else if (token[0] == '"') {
-		type = SPECIAL;
-		tag = ARRAY;
-		auto i = token.begin() + 1;
-		while (i != token.end())
-			values.push_back(std::make_shared<Term>(utf8::unchecked::next(i)));
+		type = STRING;
+		tag = 0;
+		text = std::make_shared<Text>(token.substr(1));
 	} else {
 		type = SPECIAL;
 		tag = SYMBOL;
-		auto i = token.begin();
-		while (i != token.end())
-			values.push_back(std::make_shared<Term>(utf8::unchecked::next(i)));
+		text = std::make_shared<Text>(token);
+	}
+}
+
+/**
+ * Gets the elements of a sequence. A string is expanded into the given
+ * storage; an array's own elements are returned directly.
+ */
+static const std::vector<std::shared_ptr<Term>>& elements
+	(const Term& sequence, std::vector<std::shared_ptr<Term>>& storage) {
+	if (sequence.type != Term::STRING)
+		return sequence.values;
+	auto characters = sequence.text->characters();
+	storage.reserve(characters.size());
+	for (auto i = characters.begin(); i != characters.end(); ++i)
+		storage.push_back(std::make_shared<Term>(int64_t(*i)));
+	return storage;
+}
+
+/**
+ * Gets the array form of a sequence, expanding a string into characters.
+ */
+static std::shared_ptr<Term> as_array(std::shared_ptr<Term> sequence) {
+	if (sequence->type != Term::STRING)
+		return sequence;
+	auto result = std::make_shared<Term>();
+	elements(*sequence, result->values);
+	return result;
+}
+
+/**
+ * Tests whether a Term is a scalar that is a valid character: a code point
+ * other than a surrogate, which cannot be encoded.
+ */
+static bool is_character(const Term& term) {
+	return term.type == Term::SCALAR && term.tag >= 0 && term.tag <= 0x10FFFF
+		&& (term.tag < 0xD800 || term.tag > 0xDFFF);
+}
+
+/**
+ * Makes a one-character Text.
+ */
+static Text character_text(uint32_t character) {
+	return Text(&character, &character + 1);
+}
+
+/**
+ * Gets the string form of an array of characters, or null if it has any
+ * element that is not a character.
+ */
+static std::shared_ptr<Term> as_string(const Term& array) {
+	if (array.type == Term::STRING)
+		return std::make_shared<Term>(array.text);
+	std::vector<uint32_t> characters;
+	characters.reserve(array.values.size());
+	for (auto i = array.values.begin(); i != array.values.end(); ++i) {
+		if (!is_character(**i))
+			return std::shared_ptr<Term>();
+		characters.push_back((*i)->tag);
+	}
+	return std::make_shared<Term>(std::make_shared<Text>
+		(characters.data(), characters.data() + characters.size()));
+}
+
+/**
+ * Counts an application of a body against the call depth limit for as long as
+ * it is in progress.
+ */
+class Call {
+	Context& context;
+public:
+	Call(Context& context) : context(context) { context.enter(); }
+	~Call() { context.leave(); }
+};
+
+/**
+ * A quotation applied once per array element. Symbols in the quotation cache
+ * their bodies on first use, and the quotation is flattened on first use, so
+ * only the quotation itself is unpacked here.
+ */
+class Callback {
+	std::shared_ptr<Term> body;
+public:
+	Callback(std::shared_ptr<Term>);
+	void operator()(Context&);
+};
+
+/**
+ * Prepares a quotation for repeated application.
+ */
+Callback::Callback(std::shared_ptr<Term> quotation) {
+	if (quotation->type == Term::SPECIAL || quotation->type == Term::STRING) {
+		body = as_array(quotation);
+	} else {
+		body = std::make_shared<Term>();
+		body->values.push_back(quotation);
+	}
+}
+
+/**
+ * Applies the quotation to the stack.
+ */
+void Callback::operator()(Context& context) {
+	body->apply(context);
+}
+
+/**
+ * Estimates the bytes needed for the result of an arithmetic builtin, so that
+ * a repetition can be refused before it is attempted.
+ */
+static std::size_t result_bytes
+	(int64_t operation, const Term& a, const Term& b) {
+	auto size = [](const Term& term) -> std::size_t {
+		return term.text ? term.text->data().size()
+			: term.values.size() * sizeof(std::shared_ptr<Term>);
+	};
+	if (operation == Term::MUL && a.type != b.type) {
+		const Term& count = a.type == Term::SCALAR ? a : b;
+		const Term& sequence = a.type == Term::SCALAR ? b : a;
+		std::size_t bytes;
+		if (count.type == Term::SCALAR && count.tag > 0)
+			return __builtin_mul_overflow
+				(size(sequence), std::size_t(count.tag), &bytes)
+				? std::numeric_limits<std::size_t>::max() : bytes;
+	}
+	if (operation == Term::ADD || operation == Term::COMPOSE)
+		return size(a) + size(b);
+	return 0;
+}
+
+/// The fewest elements that pmap gives to each thread.
+static const std::size_t minimum_chunk = 64;
+
+/**
+ * Maps a quotation over an array on several threads, each with its own stack,
+ * and collects the results in order. The quotation and array must have been
+ * prepared.
+ */
+static std::shared_ptr<Term> parallel_map(Context& context,
+	std::shared_ptr<Term> quotation, std::shared_ptr<Term> array,
+	std::size_t threads) {
+	const auto& input = array->values;
+	std::vector<std::shared_ptr<Term>> results(input.size());
+	std::vector<std::exception_ptr> errors(threads);
+	std::vector<std::unique_ptr<Context>> workers;
+	for (std::size_t t = 0; t < threads; ++t)
+		workers.emplace_back(new Context(&context, threads));
+	Callback callback(quotation);
+	std::vector<std::thread> pool;
+	for (std::size_t t = 0; t < threads; ++t) {
+		pool.emplace_back([&, t] {
+			auto& worker = *workers[t];
+			auto usage = worker.track();
+			auto end = input.size() * (t + 1) / threads;
+			try {
+				for (auto i = input.size() * t / threads; i < end; ++i) {
+					worker.push(input[i]);
+					callback(worker);
+					results[i] = worker.pop();
+				}
+			} catch (...) {
+				errors[t] = std::current_exception();
+			}
+		});
+	}
+	for (auto i = pool.begin(); i != pool.end(); ++i)
+		i->join();
+	for (auto i = workers.begin(); i != workers.end(); ++i)
+		context.merge(**i);
+	for (auto i = errors.begin(); i != errors.end(); ++i)
+		if (*i)
+			std::rethrow_exception(*i);
+	auto result = std::make_shared<Term>();
+	result->values = std::move(results);
+	return result;
+}
+
+/**
+ * Tests whether every element of an array is a scalar.
+ */
+static bool all_scalars(const Term& array) {
+	for (auto i = array.values.begin(); i != array.values.end(); ++i)
+		if ((*i)->type != Term::SCALAR)
+			return false;
+	return true;
+}
+
+/**
+ * Matches a quotation of the form (operand operator), where the operator is
+ * one that can be applied to a whole scalar array in a single loop.
+ */
+static bool scalar_step(const Term& quotation, int64_t& operand, int64_t& op) {
+	if (quotation.type == Term::SCALAR || quotation.values.size() != 2)
+		return false;
+	const Term& a = *quotation.values[0];
+	const Term& b = *quotation.values[1];
+	if (a.type != Term::SCALAR || b.type != Term::SPECIAL)
+		return false;
+	if (b.tag != Term::ADD && b.tag != Term::SUB && b.tag != Term::MUL)
+		return false;
+	operand = a.tag;
+	op = b.tag;
+	return true;
+}
+
+/**
+ * Maps an arithmetic step over a scalar array. Yields null if any element
+ * overflows, in which case the caller takes the general path.
+ */
+static std::shared_ptr<Term> scalar_map
+	(const Term& array, int64_t operand, int64_t op) {
+	std::vector<int64_t> scalars(array.values.size());
+	for (std::size_t i = 0; i < scalars.size(); ++i)
+		scalars[i] = array.values[i]->tag;
+	bool overflow = false;
+	switch (op) {
+	case Term::ADD:
+		for (std::size_t i = 0; i < scalars.size(); ++i)
+			overflow |= __builtin_add_overflow(scalars[i], operand, &scalars[i]);
+		break;
+	case Term::SUB:
+		for (std::size_t i = 0; i < scalars.size(); ++i)
+			overflow |= __builtin_sub_overflow(scalars[i], operand, &scalars[i]);
+		break;
+	case Term::MUL:
+		for (std::size_t i = 0; i < scalars.size(); ++i)
+			overflow |= __builtin_mul_overflow(scalars[i], operand, &scalars[i]);
+		break;
+	}
+	if (overflow) return std::shared_ptr<Term>();
+	auto result = std::make_shared<Term>();
+	result->values.reserve(scalars.size());
+	for (auto i = scalars.begin(); i != scalars.end(); ++i)
+		result->values.push_back(std::make_shared<Term>(*i));
+	return result;
+}
+
+/**
+ * Gets the array or string operand of an array builtin.
+ */
+static std::shared_ptr<Term> pop_sequence(Context& context, const char* name) {
+	auto sequence = context.pop();
+	if (sequence->type != Term::SPECIAL && sequence->type != Term::STRING) {
+		std::ostringstream message;
+		message << name << " expects an array, not " << *sequence << ".";
+		throw std::runtime_error(message.str());
+	}
+	return sequence;
+}
+
+/**
+ * Gets the array operand of an array builtin, expanding a string.
+ */
+static std::shared_ptr<Term> pop_array(Context& context, const char* name) {
+	return as_array(pop_sequence(context, name));
+}
+
+/**
+ * Gets the index operand of an array builtin.
+ */
+static std::size_t pop_index(Context& context, const char* name) {
+	auto index = context.pop();
+	if (index->type != Term::SCALAR || index->tag < 0) {
+		std::ostringstream message;
+		message << name << " expects a nonnegative index, not "
+			<< *index << ".";
+		throw std::runtime_error(message.str());
+	}
+	return index->tag;
+}
+
+/**
+ * Gets a port number operand.
+ */
+static uint32_t pop_port(Context& context, const char* name) {
+	auto port = context.pop();
+	if (port->type != Term::SCALAR || port->tag < 0 || port->tag > UINT32_MAX) {
+		std::ostringstream message;
+		message << name << " expects a port number, not " << *port << ".";
+		throw std::runtime_error(message.str());
+	}
+	return port->tag;
+}
+
+/**
+ * Escapes a character array, pushing the result or, if a port is given on top
+ * of the array, writing it to that port. The text is escaped as UTF-8 bytes,
+ * without decoding it.
+ */
+static void escape(Context& context, Escaper::Kind kind) {
+	bool to_port = context.top()->type == Term::SCALAR;
+	uint32_t port = to_port ? pop_port(context, "escape") : 0;
+	auto string = as_string(*pop_sequence(context, "escape"));
+	if (!string)
+		throw std::runtime_error("escape expects a string.");
+	const auto& input = string->text->data();
+	std::string output;
+	output.reserve(input.size());
+	Escaper escaper(kind);
+	escaper(input, output);
+	if (to_port) {
+		context.put(port, output);
+		return;
 	}
+	context.push(std::make_shared<Term>
+		(std::make_shared<Text>(std::move(output))));
 }
 
 /**
- * Evaluates a Term.
+ * Evaluates a Term. Builtins that apply other Terms are handled here, and the
+ * rest out of line, so that each level of recursion costs only a small native
+ * stack frame. Errors are given the position of the innermost Term whose
+ * position is known, which costs nothing unless an error occurs.
  * @param context Evaluation context.
  */
-void Term::operator()(Context& context) {
+void Term::operator()(Context& context) try {
+	context.step();
 	if (is_value()) {
 		context.push(shared_from_this());
 		return;
 	}
+	if (tag == SYMBOL) {
+		resolve(context)->apply(context);
+		return;
+	}
+	auto before = context.size();
 	switch (tag) {
+	case APPLY:
+		{
+			auto body = context.pop();
+			context.record(tag, before);
+			body->apply(context);
+			break;
+		}
+	case COND:
+		{
+			auto else_body = context.pop();
+			auto then_body = context.pop();
+			auto test = context.pop();
+			context.record(tag, before);
+			(*test != Term(0) ? then_body : else_body)->apply(context);
+			break;
+		}
+	default:
+		builtin(tag, context);
+		context.record(tag, before);
+		break;
+	}
+} catch (const std::runtime_error& error) {
+	context.rethrow_located(*this, error);
+	throw;
+}
+
+/**
+ * Finds the body of the word named by a symbol. Words cannot be redefined, so
+ * the body found by the first lookup stays valid for as long as the Context's
+ * words do.
+ * @param context Evaluation context.
+ */
+Term* Term::resolve(Context& context) {
+	auto generation = context.get_generation();
+	bool hit = resolved_generation == generation && context.is_optimized();
+	if (!hit) {
+		resolved = context.get_word(shared_from_this()).get();
+		resolved_generation = generation;
+	}
+	context.count_lookup(hit);
+	return resolved;
+}
+
+/**
+ * Evaluates any builtin not handled directly by operator().
+ * @param context Evaluation context.
+ */
+__attribute__((noinline)) void Term::builtin
+	(int64_t operation, Context& context) {
+	switch (operation) {
 	case DEF:
 		{
 			auto name = context.pop();
@@ -91,9 +617,19 @@ void Term::operator()(Context& context) {
 			context.define_word(name, body);
 			break;
 		}
-	case SYMBOL:
+	case MACRO:
 		{
-			context.get_word(shared_from_this())->apply(context);
+			auto name = context.pop();
+			auto body = context.pop();
+			context.define_macro(name, body);
+			break;
+		}
+	case REQUIRE:
+		{
+			auto name = context.pop();
+			if (name->is_scalar())
+				throw std::runtime_error("Expected a module name to require.");
+			context.require(name);
 			break;
 		}
 	case DUP:
@@ -117,28 +653,305 @@ void Term::operator()(Context& context) {
 			context.push(result);
 			break;
 		}
-	case APPLY:
-		context.pop()->apply(context);
-		break;
 	case WRITE:
-		std::cout << *context.pop() << '\n';
-		break;
+		{
+			auto value = context.pop();
+			std::string buffer;
+			buffer.reserve(value->serialized_size() + 1);
+			value->serialize(buffer);
+			buffer += '\n';
+			std::cout.write(buffer.data(), buffer.size());
+			break;
+		}
 	case PUTC:
 		{
-			auto port = context.pop();
+			auto port = pop_port(context, "putc");
 			auto character = context.pop();
-			if (character->is_scalar() && port->is_scalar()) {
-				utf8::utf32to8(&character->tag, &character->tag + 1,
-					std::ostreambuf_iterator<char>
-					(context.get_output_port(port->tag)));
+			if (character->is_string()) {
+				context.put(port, character->text->data());
+			} else if (is_character(*character)) {
+				context.put(port, character->tag);
 			} else {
 				std::ostringstream message;
-				message << "putc does not understand arrays in:\n"
-					<< *character << " " << *port << " putc";
+				message << "putc does not understand non-characters in:\n"
+					<< *character << " " << port << " putc";
 				throw std::runtime_error(message.str());
 			}
 			break;
 		}
+	case OPEN_INPUT:
+	case OPEN_OUTPUT:
+		{
+			auto name = context.pop();
+			if (name->is_scalar())
+				throw std::runtime_error("Expected a file name to open.");
+			context.push(std::make_shared<Term>(int64_t(operation == OPEN_INPUT
+				? context.open_input(name)
+				: context.open_output(name))));
+			break;
+		}
+	case OPEN_BUFFER:
+		context.push(std::make_shared<Term>(int64_t(context.open_buffer())));
+		break;
+	case OPEN_GENERATOR:
+		{
+			auto quotation = context.pop();
+			auto seed = context.pop();
+			context.push(std::make_shared<Term>
+				(int64_t(context.open_generator(seed, quotation))));
+			break;
+		}
+	case CLOSE:
+		{
+			context.close_port(pop_port(context, "close"));
+			break;
+		}
+	case READ:
+		{
+			auto port = pop_port(context, "read");
+			auto count = pop_index(context, "read");
+			context.push(context.read(port, count));
+			break;
+		}
+	case CONTENTS:
+		{
+			context.push(context.contents(pop_port(context, "contents")));
+			break;
+		}
+	case LENGTH:
+		{
+			auto sequence = pop_sequence(context, "length");
+			context.push(std::make_shared<Term>(int64_t(sequence->is_string()
+				? sequence->text->size() : sequence->values.size())));
+			break;
+		}
+	case NTH:
+		{
+			auto index = pop_index(context, "nth");
+			auto sequence = pop_sequence(context, "nth");
+			auto size = sequence->is_string()
+				? sequence->text->size() : sequence->values.size();
+			if (index >= size)
+				throw std::runtime_error("nth index out of range.");
+			context.push(sequence->is_string()
+				? std::make_shared<Term>(int64_t(sequence->text->at(index)))
+				: sequence->values[index]);
+			break;
+		}
+	case SLICE:
+		{
+			auto end = pop_index(context, "slice");
+			auto begin = pop_index(context, "slice");
+			auto sequence = pop_sequence(context, "slice");
+			auto size = sequence->is_string()
+				? sequence->text->size() : sequence->values.size();
+			if (begin > end || end > size)
+				throw std::runtime_error("slice range out of bounds.");
+			if (sequence->is_string()) {
+				context.push(std::make_shared<Term>(std::make_shared<Text>
+					(sequence->text->slice(begin, end))));
+				break;
+			}
+			auto result = std::make_shared<Term>();
+			result->values.assign(sequence->values.begin() + begin,
+				sequence->values.begin() + end);
+			context.push(result);
+			break;
+		}
+	case REVERSE:
+		{
+			auto sequence = pop_sequence(context, "reverse");
+			if (sequence->is_string()) {
+				auto characters = sequence->text->characters();
+				std::reverse(characters.begin(), characters.end());
+				context.push(std::make_shared<Term>(std::make_shared<Text>
+					(characters.data(), characters.data() + characters.size())));
+				break;
+			}
+			auto array = sequence;
+			auto result = std::make_shared<Term>();
+			result->values.assign(array->values.rbegin(),
+				array->values.rend());
+			context.push(result);
+			break;
+		}
+	case PMAP:
+		{
+			auto quotation = context.pop();
+			auto array = pop_array(context, "pmap");
+			auto threads = std::min<std::size_t>
+				(std::thread::hardware_concurrency(),
+				array->values.size() / minimum_chunk);
+			std::set<const Term*> visited;
+			if (threads > 1 && context.is_optimized() && !context.is_worker()
+				&& quotation->prepare(context, visited)
+				&& array->prepare(context, visited)) {
+				context.push(parallel_map(context, quotation, array, threads));
+				break;
+			}
+			// Quotations with effects are mapped in order, as by map.
+			context.push(array);
+			context.push(quotation);
+		}
+		// fallthrough
+	case MAP:
+		{
+			auto quotation = context.pop();
+			auto array = pop_array(context, "map");
+			int64_t operand, op;
+			if (context.is_optimized() && scalar_step(*quotation, operand, op)
+				&& all_scalars(*array)) {
+				if (auto result = scalar_map(*array, operand, op)) {
+					context.push(result);
+					break;
+				}
+			}
+			Callback callback(quotation);
+			auto result = std::make_shared<Term>();
+			result->values.reserve(array->values.size());
+			for (auto i = array->values.begin(); i != array->values.end(); ++i) {
+				context.push(*i);
+				callback(context);
+				result->values.push_back(context.pop());
+			}
+			context.push(result);
+			break;
+		}
+	case FOLD:
+		{
+			auto quotation = context.pop();
+			auto initial = context.pop();
+			auto array = pop_array(context, "fold");
+			if (context.is_optimized() && quotation->values.size() == 1
+				&& quotation->values[0]->type == SPECIAL
+				&& (quotation->values[0]->tag == ADD
+					|| quotation->values[0]->tag == MUL)
+				&& initial->is_small() && all_scalars(*array)) {
+				int64_t result = initial->tag;
+				bool overflow = false;
+				if (quotation->values[0]->tag == ADD)
+					for (auto i = array->values.begin();
+						i != array->values.end(); ++i)
+						overflow |= __builtin_add_overflow
+							(result, (*i)->tag, &result);
+				else
+					for (auto i = array->values.begin();
+						i != array->values.end(); ++i)
+						overflow |= __builtin_mul_overflow
+							(result, (*i)->tag, &result);
+				if (!overflow) {
+					context.push(std::make_shared<Term>(result));
+					break;
+				}
+			}
+			Callback callback(quotation);
+			context.push(initial);
+			for (auto i = array->values.begin(); i != array->values.end(); ++i) {
+				context.push(*i);
+				callback(context);
+			}
+			break;
+		}
+	case FILTER:
+		{
+			auto quotation = context.pop();
+			auto sequence = pop_sequence(context, "filter");
+			auto array = as_array(sequence);
+			Callback callback(quotation);
+			auto result = std::make_shared<Term>();
+			for (auto i = array->values.begin(); i != array->values.end(); ++i) {
+				context.push(*i);
+				callback(context);
+				if (*context.pop() != Term(0))
+					result->values.push_back(*i);
+			}
+			context.push(sequence->is_string() ? as_string(*result) : result);
+			break;
+		}
+	case EACH:
+		{
+			auto quotation = context.pop();
+			auto array = pop_array(context, "each");
+			Callback callback(quotation);
+			for (auto i = array->values.begin(); i != array->values.end(); ++i) {
+				context.push(*i);
+				callback(context);
+			}
+			break;
+		}
+	case ESCAPE_HTML:
+		escape(context, Escaper::HTML);
+		break;
+	case ESCAPE_ATTRIBUTE:
+		escape(context, Escaper::ATTRIBUTE);
+		break;
+	case ESCAPE_JS:
+		escape(context, Escaper::JAVASCRIPT);
+		break;
+	case ESCAPE_CSS:
+		escape(context, Escaper::CSS);
+		break;
+	case ESCAPE_URL:
+		escape(context, Escaper::URL);
+		break;
+	case TO_STRING:
+		{
+			auto result = as_string(*pop_sequence(context, "string"));
+			if (!result)
+				throw std::runtime_error("string expects an array of characters.");
+			context.push(result);
+			break;
+		}
+	case TO_CHARS:
+		context.push(as_array(pop_sequence(context, "chars")));
+		break;
+	case TO_REAL:
+		{
+			auto value = context.pop();
+			if (!value->is_scalar())
+				throw std::runtime_error("real expects a number.");
+			auto result = std::make_shared<Term>();
+			result->assign(value->to_real());
+			context.push(result);
+			break;
+		}
+	case TRUNCATE:
+		{
+			auto value = context.pop();
+			if (!value->is_scalar())
+				throw std::runtime_error("truncate expects a number.");
+			if (!value->is_real()) {
+				context.push(value);
+				break;
+			}
+			auto result = std::trunc(value->real);
+			if (!(result >= -9223372036854775808.0
+				&& result < 9223372036854775808.0))
+				throw std::runtime_error("truncate result out of range.");
+			context.push(std::make_shared<Term>(int64_t(result)));
+			break;
+		}
+// The left operand is updated in place when the stack held the only reference
+// to it, and copied once otherwise.
+#define ASSIGNMENT_TERM(id, symbol)                             \
+	case id:                                                    \
+		{                                                       \
+			auto b = context.pop();                             \
+			auto a = context.pop();                             \
+			context.reserve(result_bytes(id, *a, *b));          \
+			if (a.use_count() != 1 || !context.is_optimized())  \
+				a = std::make_shared<Term>(*a);                 \
+			*a symbol##= *b;                                    \
+			context.push(a);                                    \
+			break;                                              \
+		}
+	ASSIGNMENT_TERM(COMPOSE, +)
+	ASSIGNMENT_TERM(ADD, +)
+	ASSIGNMENT_TERM(SUB, -)
+	ASSIGNMENT_TERM(MUL, *)
+	ASSIGNMENT_TERM(DIV, /)
+	ASSIGNMENT_TERM(MOD, %)
+#undef ASSIGNMENT_TERM
 #define OPERATOR_TERM(id, symbol)                               \
 	case id:                                                    \
 		{                                                       \
@@ -147,12 +960,6 @@ void Term::operator()(Context& context) {
 			context.push(std::make_shared<Term>(*a symbol *b)); \
 			break;                                              \
 		}
-	OPERATOR_TERM(COMPOSE, +)
-	OPERATOR_TERM(ADD, +)
-	OPERATOR_TERM(SUB, -)
-	OPERATOR_TERM(MUL, *)
-	OPERATOR_TERM(DIV, /)
-	OPERATOR_TERM(MOD, %)
 	OPERATOR_TERM(LT, <)
 	OPERATOR_TERM(GT, >)
 	OPERATOR_TERM(LE, <=)
@@ -160,14 +967,6 @@ void Term::operator()(Context& context) {
 	OPERATOR_TERM(EQ, ==)
 	OPERATOR_TERM(NE, !=)
 #undef OPERATOR_TERM
-	case COND:
-		{
-			auto else_body = context.pop();
-			auto then_body = context.pop();
-			auto test = context.pop();
-			(*test != Term(0) ? then_body : else_body)->apply(context);
-			break;
-		}
 	}
 }
 
@@ -178,31 +977,269 @@ void Term::operator()(Context& context) {
 void Term::apply(Context& context) {
 	if (is_scalar()) {
 		(*this)(context);
+	} else if (is_string()) {
+		auto characters = text->characters();
+		for (auto i = characters.begin(); i != characters.end(); ++i)
+			context.push(std::make_shared<Term>(int64_t(*i)));
 	} else {
-		for (auto i = values.begin(); i != values.end(); ++i)
-			(**i)(context);
+		Call call(context);
+		if (!context.is_optimized()) {
+			for (auto i = values.begin(); i != values.end(); ++i)
+				(**i)(context);
+			return;
+		}
+		// Workers only read shared Terms, so their quotations are flattened
+		// beforehand by prepare().
+		auto outer = code ? nullptr : enclosing.lock();
+		if (!code && !outer && values.size() > 1 && !context.is_worker())
+			Code::compile(*this);
+		if (code) {
+			execute(context, *code);
+		} else if (outer) {
+			execute(context, *outer);
+		} else {
+			for (auto i = values.begin(); i != values.end(); ++i)
+				(**i)(context);
+		}
 	}
 }
 
 /**
- * Adds Terms.
+ * Applies the flattened form of a quotation. This does the work of
+ * operator() for each node in turn, without visiting the Terms themselves
+ * except to look up symbols, and without a native frame per Term.
+ * @param context Evaluation context.
+ * @param code Code holding this quotation's nodes, which the caller keeps.
+ */
+void Term::execute(Context& context, const Code& code) {
+	// A quotation can only be changed in place by its sole owner, which is
+	// applying it, so its Code outlives the scan.
+	const auto& nodes = code.nodes;
+	const auto& pushed = code.values;
+	for (auto i = code_begin; i < code_end; ++i) {
+		const auto& node = nodes[i];
+		if (node.kind == Code::VALUE) {
+			context.step();
+			context.push(pushed[node.immediate]);
+			i += node.span;
+			continue;
+		}
+		try {
+			context.step();
+			if (node.immediate == SYMBOL) {
+				node.term->resolve(context)->apply(context);
+				continue;
+			}
+			auto before = context.size();
+			switch (node.immediate) {
+			case APPLY:
+				{
+					auto body = context.pop();
+					context.record(APPLY, before);
+					body->apply(context);
+					break;
+				}
+			case COND:
+				{
+					auto else_body = context.pop();
+					auto then_body = context.pop();
+					auto test = context.pop();
+					context.record(COND, before);
+					(*test != Term(0) ? then_body : else_body)->apply(context);
+					break;
+				}
+			default:
+				builtin(node.immediate, context);
+				context.record(node.immediate, before);
+				break;
+			}
+		} catch (const std::runtime_error& error) {
+			context.rethrow_located(*node.term, error);
+			throw;
+		}
+	}
+}
+
+/**
+ * Readies a Term to be evaluated on several threads at once, by resolving the
+ * symbols reachable from it and bringing its allocation count up to date, so
+ * that evaluation only reads shared Terms. Yields false if a reachable builtin
+ * has effects besides on the stack.
+ */
+bool Term::prepare(Context& context, std::set<const Term*>& visited) {
+	std::vector<Term*> pending { this };
+	while (!pending.empty()) {
+		auto term = pending.back();
+		pending.pop_back();
+		if (!visited.insert(term).second)
+			continue;
+		term->account();
+		if (term->type != SPECIAL)
+			continue;
+		int inputs, outputs;
+		switch (term->tag) {
+		case SYMBOL:
+			if (term->resolved_generation != context.get_generation()) {
+				try {
+					term->resolved
+						= context.get_word(term->shared_from_this()).get();
+				} catch (const LimitError&) {
+					throw;
+				} catch (const std::runtime_error&) {
+					// Reported when the symbol is evaluated.
+					continue;
+				}
+				term->resolved_generation = context.get_generation();
+			}
+			pending.push_back(term->resolved);
+			break;
+		case ARRAY:
+			if (!term->code && term->enclosing.expired()
+				&& term->values.size() > 1 && !context.is_worker())
+				Code::compile(*term);
+			for (auto i = term->values.begin(); i != term->values.end(); ++i)
+				pending.push_back(i->get());
+			break;
+		case APPLY:
+		case COND:
+		case MAP:
+		case FOLD:
+		case FILTER:
+		case EACH:
+		case PMAP:
+			break;
+		default:
+			if (!stack_effect(term->tag, inputs, outputs))
+				return false;
+			break;
+		}
+	}
+	return true;
+}
+
+/**
+ * Gets the number of builtin operations, which bounds the tags of special
+ * Terms.
+ */
+std::size_t Term::operation_count() {
+	return names.size();
+}
+
+/**
+ * Gets the numbers of inputs and outputs of a builtin that has no effects
+ * besides on the stack. Yields false for any other builtin.
+ */
+bool Term::stack_effect(int64_t operation, int& inputs, int& outputs) {
+	outputs = 1;
+	switch (operation) {
+	case DUP:
+		inputs = 1;
+		outputs = 2;
+		return true;
+	case POP:
+		inputs = 1;
+		outputs = 0;
+		return true;
+	case SWAP:
+		inputs = 2;
+		outputs = 2;
+		return true;
+	case QUOTE:
+	case LENGTH:
+	case REVERSE:
+	case TO_REAL:
+	case TRUNCATE:
+	case TO_STRING:
+	case TO_CHARS:
+	case ESCAPE_HTML:
+	case ESCAPE_ATTRIBUTE:
+	case ESCAPE_JS:
+	case ESCAPE_CSS:
+	case ESCAPE_URL:
+		inputs = 1;
+		return true;
+	case COMPOSE:
+	case ADD:
+	case SUB:
+	case MUL:
+	case DIV:
+	case MOD:
+	case LT:
+	case GT:
+	case LE:
+	case GE:
+	case EQ:
+	case NE:
+	case NTH:
+		inputs = 2;
+		return true;
+	case SLICE:
+		inputs = 3;
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * Adds Terms. Machine integers are added directly unless the sum overflows,
+ * in which case the result is promoted to a Bignum. Strings concatenate with
+ * strings and characters, remaining strings; a string that no other Term
+ * shares is extended in place, as is an array, which loses its flattened
+ * form.
  */
 Term& Term::operator+=(const Term& other) {
+	code.reset();
+	enclosing.reset();
+	if (is_string() && (other.is_string() || is_character(other))) {
+		auto tail = other.is_string() ? other.text
+			: std::make_shared<Text>(character_text(other.tag));
+		if (text.use_count() == 1)
+			std::const_pointer_cast<Text>(text)->append(*tail);
+		else
+			text = std::make_shared<Text>(*text, *tail);
+		return *this;
+	}
+	if (is_character(*this) && other.is_string()) {
+		text = std::make_shared<Text>(character_text(tag), *other.text);
+		type = STRING;
+		tag = 0;
+		return *this;
+	}
+	std::vector<std::shared_ptr<Term>> storage;
 	if (is_scalar()) {
 		if (other.is_scalar()) {
-			tag += other.tag;
+			int64_t result;
+			if (is_real() || other.is_real()) {
+				assign(to_real() + other.to_real());
+			} else if (is_small() && other.is_small()
+				&& !__builtin_add_overflow(tag, other.tag, &result)) {
+				tag = result;
+			} else {
+				auto sum = bignum();
+				sum += other.bignum();
+				assign(sum);
+			}
 		} else {
-			values.push_back(std::make_shared<Term>(tag));
-			tag = 0;
-			std::copy(other.values.begin(), other.values.end(),
-				std::back_inserter(values));
+			values.push_back(std::make_shared<Term>(*this));
+			type = SPECIAL;
+			tag = ARRAY;
+			big.reset();
+			const auto& tail = elements(other, storage);
+			values.insert(values.end(), tail.begin(), tail.end());
 		}
 	} else {
+		if (is_string()) {
+			elements(*this, values);
+			type = SPECIAL;
+			tag = ARRAY;
+			text.reset();
+		}
 		if (other.is_scalar()) {
-			values.push_back(std::make_shared<Term>(other.tag));
+			values.push_back(std::make_shared<Term>(other));
 		} else {
-			std::copy(other.values.begin(), other.values.end(),
-				std::back_inserter(values));
+			const auto& tail = elements(other, storage);
+			values.insert(values.end(), tail.begin(), tail.end());
 		}
 	}
 	return *this;
@@ -212,36 +1249,90 @@ Term& Term::operator+=(const Term& other) {
  * Subtracts Terms.
  */
 Term& Term::operator-=(const Term& other) {
-	if (is_scalar() && other.is_scalar())
-		tag -= other.tag;
-	else
+	if (!is_scalar() || !other.is_scalar())
 		throw std::runtime_error("- cannot be applied to sequences.");
+	int64_t result;
+	if (is_real() || other.is_real()) {
+		assign(to_real() - other.to_real());
+	} else if (is_small() && other.is_small()
+		&& !__builtin_sub_overflow(tag, other.tag, &result)) {
+		tag = result;
+	} else {
+		auto difference = bignum();
+		difference -= other.bignum();
+		assign(difference);
+	}
 	return *this;
 }
 
 /**
- * Multiplies Terms.
+ * Gets the number of elements in a sequence repeated some number of times,
+ * refusing counts that are negative or that would exceed the given maximum.
+ */
+static std::size_t repeated_size
+	(std::size_t size, const Term& count, std::size_t maximum) {
+	std::size_t result;
+	if (count.type != Term::SCALAR || count.tag < 0
+		|| __builtin_mul_overflow(size, std::size_t(count.tag), &result)
+		|| result > maximum)
+		throw std::runtime_error("* can't repeat that many times.");
+	return result;
+}
+
+/**
+ * Multiplies Terms. A repeated array is built afresh, since its elements
+ * cannot be appended to the vector that holds them.
  */
 Term& Term::operator*=(const Term& other) {
+	code.reset();
+	enclosing.reset();
+	if (is_string() != other.is_string() && (is_scalar() || other.is_scalar())) {
+		const Term& count = is_string() ? other : *this;
+		const Term& sequence = is_string() ? *this : other;
+		repeated_size(sequence.text->data().size(), count,
+			std::string().max_size());
+		auto repeated = std::make_shared<Text>
+			(sequence.text->repeat(count.tag));
+		type = STRING;
+		tag = 0;
+		big.reset();
+		text = repeated;
+		return *this;
+	}
+	if (is_string() || other.is_string())
+		throw std::runtime_error("* cannot be applied to two sequences.");
 	if (is_scalar()) {
 		if (other.is_scalar()) {
-			tag *= other.tag;
+			int64_t result;
+			if (is_real() || other.is_real()) {
+				assign(to_real() * other.to_real());
+			} else if (is_small() && other.is_small()
+				&& !__builtin_mul_overflow(tag, other.tag, &result)) {
+				tag = result;
+			} else {
+				auto product = bignum();
+				product *= other.bignum();
+				assign(product);
+			}
 		} else {
-			if (tag < 0)
-				throw std::runtime_error("* can't repeat negative times.");
-			for (int32_t i = 0; i < tag; ++i)
-				std::copy(other.values.begin(), other.values.end(),
-					std::back_inserter(values));
-			tag = 0;
+			std::vector<std::shared_ptr<Term>> result;
+			result.reserve(repeated_size
+				(other.values.size(), *this, result.max_size()));
+			for (int64_t i = 0; i < tag; ++i)
+				result.insert(result.end(),
+					other.values.begin(), other.values.end());
+			values.swap(result);
+			type = SPECIAL;
+			tag = ARRAY;
 		}
 	} else {
 		if (other.is_scalar()) {
-			if (other.tag < 0)
-				throw std::runtime_error("* can't repeat negative times.");
-			auto size = values.size();
-			for (int32_t i = 0; i < other.tag - 1; ++i)
-				std::copy(values.begin(), values.begin() + size,
-					std::back_inserter(values));
+			std::vector<std::shared_ptr<Term>> result;
+			result.reserve(repeated_size
+				(values.size(), other, result.max_size()));
+			for (int64_t i = 0; i < other.tag; ++i)
+				result.insert(result.end(), values.begin(), values.end());
+			values.swap(result);
 		} else {
 			throw std::runtime_error
 				("* cannot be applied to two sequences.");
@@ -251,13 +1342,21 @@ Term& Term::operator*=(const Term& other) {
 }
 
 /**
- * Divides Terms.
+ * Divides Terms, truncating toward zero.
  */
 Term& Term::operator/=(const Term& other) {
-	if (is_scalar() && other.is_scalar())
-		tag /= other.tag;
-	else
+	if (!is_scalar() || !other.is_scalar())
 		throw std::runtime_error("/ cannot be applied to sequences.");
+	if (is_real() || other.is_real()) {
+		assign(to_real() / other.to_real());
+	} else if (is_small() && other.is_small() && other.tag != 0
+		&& !(tag == INT64_MIN && other.tag == -1)) {
+		tag /= other.tag;
+	} else {
+		auto quotient = bignum();
+		quotient /= other.bignum();
+		assign(quotient);
+	}
 	return *this;
 }
 
@@ -265,10 +1364,18 @@ Term& Term::operator/=(const Term& other) {
  * Modulates Terms.
  */
 Term& Term::operator%=(const Term& other) {
-	if (is_scalar() && other.is_scalar())
-		tag %= other.tag;
-	else
+	if (!is_scalar() || !other.is_scalar())
 		throw std::runtime_error("% cannot be applied to sequences.");
+	if (is_real() || other.is_real()) {
+		assign(std::fmod(to_real(), other.to_real()));
+	} else if (is_small() && other.is_small() && other.tag != 0
+		&& other.tag != -1) {
+		tag %= other.tag;
+	} else {
+		auto remainder = bignum();
+		remainder %= other.bignum();
+		assign(remainder);
+	}
 	return *this;
 }
 
@@ -279,84 +1386,399 @@ Term operator/(Term a, const Term& b) { return a /= b; }
 Term operator%(Term a, const Term& b) { return a %= b; }
 
 /**
- * Sorts Terms: scalars directly, arrays recursively (and lexicographically).
+ * A pair of sequences being compared element by element. Comparisons keep a
+ * list of these rather than recursing, so that deep nesting cannot overflow
+ * the native stack.
+ */
+struct ElementPair {
+	std::vector<std::shared_ptr<Term>> a_storage;
+	std::vector<std::shared_ptr<Term>> b_storage;
+	const std::vector<std::shared_ptr<Term>>* a_values;
+	const std::vector<std::shared_ptr<Term>>* b_values;
+	std::size_t index;
+};
+
+/**
+ * Starts comparing the elements of two sequences.
+ */
+static ElementPair& open_pair
+	(std::deque<ElementPair>& pairs, const Term& a, const Term& b) {
+	pairs.emplace_back();
+	auto& pair = pairs.back();
+	pair.a_values = &elements(a, pair.a_storage);
+	pair.b_values = &elements(b, pair.b_storage);
+	pair.index = 0;
+	return pair;
+}
+
+/**
+ * Sorts Terms: scalars directly, arrays lexicographically by their elements.
+ * Strings sort by their encoding, which orders them by character.
  */
 bool operator<(const Term& a, const Term& b) {
-	if (a.is_scalar() && b.is_scalar()) {
-		return a.tag < b.tag;
-	} else if (!a.is_scalar() && !b.is_scalar()) {
-		auto i = a.values.begin(), j = b.values.begin();
-		while (i != a.values.end()) {
-			if (j == b.values.end() || **j < **i)
+	std::deque<ElementPair> pairs;
+	const Term* x = &a;
+	const Term* y = &b;
+	while (true) {
+		int order = 0;
+		if (x->is_scalar() && y->is_scalar()) {
+			if (x->is_small() && y->is_small()) {
+				order = (x->tag > y->tag) - (x->tag < y->tag);
+			} else if (x->is_real() || y->is_real()) {
+				auto p = x->to_real(), q = y->to_real();
+				order = (p > q) - (p < q);
+			} else {
+				auto p = x->bignum(), q = y->bignum();
+				order = p < q ? -1 : q < p;
+			}
+		} else if (!x->is_scalar() && !y->is_scalar()) {
+			if (x->text && y->text && x->type == y->type) {
+				auto result = x->text->data().compare(y->text->data());
+				order = (result > 0) - (result < 0);
+			} else {
+				open_pair(pairs, *x, *y);
+			}
+		} else {
+			order = x->is_scalar() ? -1 : 1;
+		}
+		// The first elements to differ decide the order of every sequence
+		// that holds them.
+		if (order)
+			return order < 0;
+		while (true) {
+			if (pairs.empty())
 				return false;
-			if (**i < **j)
-				return true;
-			i++;
-			j++;
+			auto& pair = pairs.back();
+			auto a_size = pair.a_values->size(), b_size = pair.b_values->size();
+			if (pair.index < a_size && pair.index < b_size) {
+				x = (*pair.a_values)[pair.index].get();
+				y = (*pair.b_values)[pair.index].get();
+				++pair.index;
+				break;
+			}
+			if (a_size != b_size)
+				return a_size < b_size;
+			pairs.pop_back();
 		}
-		return (j != b.values.end());
-	} else {
-		return a.is_scalar() && !b.is_scalar();
 	}
 }
 
 /**
- * Tests equality of Terms: scalars directly, arrays recursively.
+ * Tests equality of Terms: scalars directly, arrays by their elements. A
+ * string is equal to the array of its characters.
  */
 bool operator==(const Term& a, const Term& b) {
-	if (a.is_scalar()) {
-		if (b.is_scalar())
-			return a.tag == b.tag;
-		return false;
-	} else if (b.is_scalar()) {
-		return false;
-	} else {
-		if (a.values.size() != b.values.size())
+	std::deque<ElementPair> pairs;
+	const Term* x = &a;
+	const Term* y = &b;
+	while (true) {
+		if (x->is_scalar()) {
+			if (!y->is_scalar())
+				return false;
+			if (x->is_small() && y->is_small()) {
+				if (x->tag != y->tag)
+					return false;
+			} else if (x->is_real() || y->is_real()) {
+				if (x->to_real() != y->to_real())
+					return false;
+			} else if (!(x->bignum() == y->bignum())) {
+				return false;
+			}
+		} else if (y->is_scalar()) {
+			return false;
+		} else if (x->is_value() != y->is_value()) {
 			return false;
-		for (auto i = a.values.begin(), j = b.values.begin();
-			i != a.values.end(); ++i, ++j)
-			if (**i != **j)
+		} else if (!x->is_value()) {
+			if (x->tag != y->tag || (x->tag == Term::SYMBOL
+				&& x->text->data() != y->text->data()))
 				return false;
-		return true;
+		} else if (x->is_string() && y->is_string()) {
+			if (x->text->data() != y->text->data())
+				return false;
+		} else {
+			auto& pair = open_pair(pairs, *x, *y);
+			if (pair.a_values->size() != pair.b_values->size())
+				return false;
+		}
+		while (true) {
+			if (pairs.empty())
+				return true;
+			auto& pair = pairs.back();
+			if (pair.index < pair.a_values->size()) {
+				x = (*pair.a_values)[pair.index].get();
+				y = (*pair.b_values)[pair.index].get();
+				++pair.index;
+				break;
+			}
+			pairs.pop_back();
+		}
 	}
 }
 
 /**
- * Writes a Term to a stream.
+ * Writes a Term to a stream in a single write.
  */
 std::ostream& operator<<(std::ostream& stream, const Term& term) {
-	if (term.is_value()) {
-		if (term.is_scalar()) {
-			return stream << term.tag;
+	std::string buffer;
+	buffer.reserve(term.serialized_size());
+	term.serialize(buffer);
+	return stream.write(buffer.data(), buffer.size());
+}
+
+/**
+ * Estimates the length of the written form of a Term, for presizing.
+ */
+std::size_t Term::serialized_size() const {
+	std::size_t size = 0;
+	std::vector<const Term*> pending { this };
+	while (!pending.empty()) {
+		auto term = pending.back();
+		pending.pop_back();
+		switch (term->type) {
+		case SCALAR:
+		case REAL:
+			size += 24;
+			continue;
+		case BIGNUM:
+			size += 64;
+			continue;
+		case STRING:
+			size += term->text->data().size() + 2;
+			continue;
+		case SPECIAL:
+			break;
+		}
+		if (!term->is_value()) {
+			size += term->text ? term->text->data().size()
+				: names[term->tag].size();
+			continue;
+		}
+		size += 3 + term->values.size();
+		for (auto i = term->values.begin(); i != term->values.end(); ++i)
+			pending.push_back(i->get());
+	}
+	return size;
+}
+
+/**
+ * Appends the written form of a Term to a buffer. Arrays are written from a
+ * list of those still open, rather than recursively, so that deep nesting
+ * cannot overflow the native stack.
+ */
+void Term::serialize(std::string& buffer) const {
+	std::vector<std::pair<const Term*, std::size_t>> open;
+	const Term* term = this;
+	while (true) {
+		if (term->type == SPECIAL && term->tag == ARRAY) {
+			buffer += "( ";
+			open.emplace_back(term, 0);
 		} else {
-			stream << "( ";
-			for (auto i = term.values.begin(); i != term.values.end(); ++i)
-				stream << **i << " ";
-			return stream << ")";
+			term->serialize_atom(buffer);
+			if (open.empty())
+				return;
+			buffer += ' ';
+		}
+		while (true) {
+			auto& array = open.back();
+			if (array.second < array.first->values.size()) {
+				term = array.first->values[array.second++].get();
+				break;
+			}
+			buffer += ')';
+			open.pop_back();
+			if (open.empty())
+				return;
+			buffer += ' ';
 		}
-	} else {
-		for (auto i = Term::operations.begin();
-			i != Term::operations.end(); ++i)
-			if (term.tag == i->second)
-				return stream << i->first;
-		std::ostreambuf_iterator<char> write(stream);
-		for (auto i = term.values.begin(); i != term.values.end(); ++i)
-			utf8::append((*i)->tag, write);
 	}
-	return stream;
+}
+
+/**
+ * Appends the written form of a Term other than an array to a buffer.
+ */
+void Term::serialize_atom(std::string& buffer) const {
+	char digits[32];
+	switch (type) {
+	case SCALAR:
+		buffer.append(digits,
+			std::to_chars(digits, digits + sizeof digits, tag).ptr);
+		return;
+	case REAL:
+		{
+			auto end = std::to_chars(digits, digits + sizeof digits, real).ptr;
+			buffer.append(digits, end);
+			if (std::isfinite(real) && std::find_if(digits, end, [](char c) {
+					return c == '.' || c == 'e';
+				}) == end)
+				buffer += ".0";
+			return;
+		}
+	case BIGNUM:
+		{
+			std::ostringstream stream;
+			stream << *big;
+			buffer += stream.str();
+			return;
+		}
+	case STRING:
+		{
+			// Escape what the tokenizer would end or unescape, so that a
+			// written string reads back as the same string.
+			const auto& data = text->data();
+			buffer += '"';
+			std::size_t start = 0, special;
+			while ((special = data.find_first_of("\"\\", start))
+				!= std::string::npos) {
+				buffer.append(data, start, special - start);
+				buffer += '\\';
+				buffer += data[special];
+				start = special + 1;
+			}
+			buffer.append(data, start, std::string::npos);
+			buffer += '"';
+			return;
+		}
+	case SPECIAL:
+		break;
+	}
+	buffer += text ? text->data() : names[tag];
 }
 
 /**
  * Tests whether a Term represents a value.
  */
 bool Term::is_value() const {
-	return type == SCALAR
+	return is_scalar() || is_string()
 		|| (type == SPECIAL && tag == ARRAY);
 }
 
 /**
- * Tests whether a Term is a scalar value.
+ * Tests whether a Term is a scalar value of any size.
  */
 bool Term::is_scalar() const {
+	return type == SCALAR || type == BIGNUM || type == REAL;
+}
+
+/**
+ * Tests whether a Term is a string value.
+ */
+bool Term::is_string() const {
+	return type == STRING;
+}
+
+/**
+ * Tests whether a Term is a scalar that fits in a machine integer.
+ */
+bool Term::is_small() const {
 	return type == SCALAR;
 }
+
+/**
+ * Tests whether a Term is a floating-point scalar.
+ */
+bool Term::is_real() const {
+	return type == REAL;
+}
+
+/**
+ * Gets the value of a scalar Term as a floating-point number.
+ */
+double Term::to_real() const {
+	switch (type) {
+	case REAL:   return real;
+	case BIGNUM: return big->to_real();
+	default:     return double(tag);
+	}
+}
+
+/**
+ * Gets the value of an integer scalar Term as a Bignum.
+ */
+Bignum Term::bignum() const {
+	return big ? *big : Bignum(tag);
+}
+
+/**
+ * Stores a floating-point result.
+ */
+void Term::assign(double value) {
+	type = REAL;
+	real = value;
+	big.reset();
+}
+
+/**
+ * Stores a scalar result, demoting it to a machine integer if it fits.
+ */
+void Term::assign(const Bignum& value) {
+	if (value.fits()) {
+		type = SCALAR;
+		tag = value.value();
+		big.reset();
+	} else {
+		type = BIGNUM;
+		tag = 0;
+		big = std::make_shared<const Bignum>(value);
+	}
+}
+
+/**
+ * Compares Terms structurally.
+ */
+bool StructuralOrder::operator()
+	(const std::shared_ptr<Term>& a, const std::shared_ptr<Term>& b) const {
+	return compare(*a, *b) < 0;
+}
+
+/**
+ * Compares Terms structurally, yielding -1, 0, or 1.
+ */
+int StructuralOrder::compare(const Term& a, const Term& b) {
+	if (a.type != b.type)
+		return a.type < b.type ? -1 : 1;
+	switch (a.type) {
+	case Term::SCALAR:
+		return a.tag < b.tag ? -1 : a.tag != b.tag;
+	case Term::REAL:
+		{
+			int result = std::memcmp(&a.real, &b.real, sizeof a.real);
+			return result < 0 ? -1 : result != 0;
+		}
+	case Term::BIGNUM:
+		return *a.big < *b.big ? -1 : !(*a.big == *b.big);
+	case Term::STRING:
+		return a.text->data().compare(b.text->data()) < 0
+			? -1 : a.text->data() != b.text->data();
+	case Term::SPECIAL:
+		break;
+	}
+	if (a.tag != b.tag)
+		return a.tag < b.tag ? -1 : 1;
+	if (a.text && b.text && a.text->data() != b.text->data())
+		return a.text->data() < b.text->data() ? -1 : 1;
+	// Elements are compared from a list of arrays still open, rather than
+	// recursively, so that deep nesting cannot overflow the native stack.
+	std::vector<std::pair<const Term*, const Term*>> open { { &a, &b } };
+	std::vector<std::size_t> indices { 0 };
+	while (!open.empty()) {
+		auto x = open.back().first, y = open.back().second;
+		auto index = indices.back()++;
+		if (index == x->values.size() || index == y->values.size()) {
+			if (x->values.size() != y->values.size())
+				return index == x->values.size() ? -1 : 1;
+			open.pop_back();
+			indices.pop_back();
+			continue;
+		}
+		const Term& i = *x->values[index];
+		const Term& j = *y->values[index];
+		if (i.type == Term::SPECIAL && j.type == Term::SPECIAL
+			&& i.tag == j.tag && !i.text && !j.text) {
+			open.emplace_back(&i, &j);
+			indices.push_back(0);
+		} else if (int result = compare(i, j)) {
+			return result;
+		}
+	}
+	return 0;
+}
@@ -3,21 +3,29 @@
  */
 #ifndef TERM_H
 #define TERM_H
+#include <cstdint>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
+class Bignum;
+class Code;
 class Context;
+class Text;
+class Trace;
 
 /**
  * A term in an expression.
  */
 class Term : public std::enable_shared_from_this<Term> {
-	static std::map<std::string, int32_t> operations;
+	static std::map<std::string, int64_t> operations;
+	static std::vector<std::string> names;
 public:
 	enum Extra {
 		DEF,
+		MACRO,
 		SYMBOL,
 		ARRAY,
 		DUP,
@@ -39,16 +47,55 @@ public:
 		GE,
 		EQ,
 		NE,
-		COND
+		COND,
+		OPEN_INPUT,
+		OPEN_OUTPUT,
+		OPEN_BUFFER,
+		CLOSE,
+		READ,
+		CONTENTS,
+		LENGTH,
+		NTH,
+		SLICE,
+		REVERSE,
+		MAP,
+		FOLD,
+		FILTER,
+		EACH,
+		ESCAPE_HTML,
+		ESCAPE_ATTRIBUTE,
+		ESCAPE_JS,
+		ESCAPE_CSS,
+		ESCAPE_URL,
+		TO_REAL,
+		TRUNCATE,
+		TO_STRING,
+		TO_CHARS,
+		PMAP,
+		REQUIRE,
+		OPEN_GENERATOR
 	};
-	enum Type { SCALAR, SPECIAL } type;
-	int32_t tag;
+	enum Type { SCALAR, SPECIAL, BIGNUM, REAL, STRING } type;
+	union {
+		int64_t tag;
+		double real;
+	};
+	std::shared_ptr<const Bignum> big;
+	std::shared_ptr<const Text> text;
 	std::vector<std::shared_ptr<Term>> values;
 	Term();
-	Term(int32_t);
+	Term(int64_t);
+	Term(std::shared_ptr<const Text>);
 	Term(const std::string&);
+	Term(const Term&);
+	~Term();
+	Term& operator=(const Term&) = delete;
 	void operator()(Context&);
 	void apply(Context&);
+	static bool stack_effect(int64_t, int&, int&);
+	static std::size_t operation_count();
+	void account();
+	bool prepare(Context&, std::set<const Term*>&);
 	Term& operator+=(const Term&);
 	Term& operator-=(const Term&);
 	Term& operator*=(const Term&);
@@ -62,9 +109,43 @@ public:
 	friend bool operator<(const Term&, const Term&);
 	friend bool operator==(const Term&, const Term&);
 	friend std::ostream& operator<<(std::ostream&, const Term&);
+	friend class Code;
+	friend class Trace;
 private:
+	Term* resolved;
+	uint64_t resolved_generation;
+	std::size_t charged;
+	std::shared_ptr<Code> code;
+	std::weak_ptr<Code> enclosing;
+	uint32_t code_begin;
+	uint32_t code_end;
+	void detach(std::vector<std::shared_ptr<Term>>&);
+	Term* resolve(Context&);
+	static void builtin(int64_t, Context&);
+	void execute(Context&, const Code&);
+	std::size_t serialized_size() const;
+	void serialize(std::string&) const;
+	void serialize_atom(std::string&) const;
 	bool is_value() const;
 	bool is_scalar() const;
+	bool is_string() const;
+	bool is_small() const;
+	bool is_real() const;
+	double to_real() const;
+	void assign(double);
+	Bignum bignum() const;
+	void assign(const Bignum&);
+};
+
+/**
+ * Orders Terms by structure rather than by value, so that Terms are equivalent
+ * only if they are interchangeable: 1 and 1.0, or a string and the array of
+ * its characters, are distinct.
+ */
+struct StructuralOrder {
+	bool operator()
+		(const std::shared_ptr<Term>&, const std::shared_ptr<Term>&) const;
+	static int compare(const Term&, const Term&);
 };
 
 #endif
@@ -0,0 +1,136 @@
+/**
+ * @file Text.cpp
+ */
+#include "Text.h"
+#include "Usage.h"
+#include <iterator>
+#include <utf8.h>
+
+/**
+ * Constructs a Text from UTF-8, which must be valid.
+ */
+Text::Text(std::string utf8)
+	: bytes(std::move(utf8)),
+	length(utf8::distance(bytes.begin(), bytes.end())) {
+	Usage::charge(bytes.size());
+}
+
+/**
+ * Constructs a Text whose length is already known.
+ */
+Text::Text(std::string utf8, std::size_t length)
+	: bytes(std::move(utf8)), length(length) {
+	Usage::charge(bytes.size());
+}
+
+/**
+ * Constructs a Text by encoding a range of characters.
+ */
+Text::Text(const uint32_t* begin, const uint32_t* end)
+	: length(end - begin) {
+	bytes.reserve(length);
+	utf8::utf32to8(begin, end, std::back_inserter(bytes));
+	Usage::charge(bytes.size());
+}
+
+/**
+ * Constructs a Text by concatenation.
+ */
+Text::Text(const Text& a, const Text& b)
+	: bytes(a.bytes + b.bytes), length(a.length + b.length) {
+	Usage::charge(bytes.size());
+}
+
+/**
+ * Copies a Text.
+ */
+Text::Text(const Text& other) : bytes(other.bytes), length(other.length) {
+	Usage::charge(bytes.size());
+}
+
+/**
+ * Releases a Text.
+ */
+Text::~Text() {
+	Usage::charge(-int64_t(bytes.size()));
+}
+
+/**
+ * Appends a Text in place.
+ */
+void Text::append(const Text& other) {
+	bytes += other.bytes;
+	length += other.length;
+	Usage::charge(other.bytes.size());
+}
+
+/**
+ * Gets the UTF-8 encoding.
+ */
+const std::string& Text::data() const {
+	return bytes;
+}
+
+/**
+ * Gets the length in characters.
+ */
+std::size_t Text::size() const {
+	return length;
+}
+
+/**
+ * Tests whether every character is a single byte, which makes indexing O(1).
+ */
+bool Text::is_ascii() const {
+	return length == bytes.size();
+}
+
+/**
+ * Gets the character at the given index.
+ */
+uint32_t Text::at(std::size_t index) const {
+	if (is_ascii())
+		return static_cast<unsigned char>(bytes[index]);
+	auto i = offset(index);
+	return utf8::unchecked::next(i);
+}
+
+/**
+ * Gets the characters in [begin, end).
+ */
+Text Text::slice(std::size_t begin, std::size_t end) const {
+	return Text(std::string(offset(begin), offset(end)));
+}
+
+/**
+ * Concatenates the given number of copies.
+ */
+Text Text::repeat(std::size_t count) const {
+	std::string result;
+	result.reserve(bytes.size() * count);
+	for (std::size_t i = 0; i < count; ++i)
+		result += bytes;
+	return Text(std::move(result), length * count);
+}
+
+/**
+ * Decodes all of the characters.
+ */
+std::vector<uint32_t> Text::characters() const {
+	std::vector<uint32_t> result;
+	result.reserve(length);
+	utf8::unchecked::utf8to32(bytes.begin(), bytes.end(),
+		std::back_inserter(result));
+	return result;
+}
+
+/**
+ * Finds the byte offset of the character at the given index.
+ */
+std::string::const_iterator Text::offset(std::size_t index) const {
+	auto i = bytes.begin();
+	if (is_ascii())
+		return i + index;
+	utf8::unchecked::advance(i, index);
+	return i;
+}
@@ -0,0 +1,39 @@
+/**
+ * @file Text.h
+ */
+#ifndef TEXT_H
+#define TEXT_H
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * A UTF-8 string with its length in characters cached. Short strings are
+ * stored inline by std::string, so a short Text costs a single allocation
+ * when created with std::make_shared. A Text is immutable once shared; only
+ * its sole owner may append to it.
+ */
+class Text {
+	std::string bytes;
+	std::size_t length;
+public:
+	explicit Text(std::string);
+	Text(const uint32_t*, const uint32_t*);
+	Text(const Text&, const Text&);
+	Text(const Text&);
+	~Text();
+	Text& operator=(const Text&) = delete;
+	void append(const Text&);
+	const std::string& data() const;
+	std::size_t size() const;
+	bool is_ascii() const;
+	uint32_t at(std::size_t) const;
+	Text slice(std::size_t, std::size_t) const;
+	Text repeat(std::size_t) const;
+	std::vector<uint32_t> characters() const;
+private:
+	Text(std::string, std::size_t);
+	std::string::const_iterator offset(std::size_t) const;
+};
+
+#endif
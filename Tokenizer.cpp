@@ -22,6 +22,7 @@ bool Tokenizer::empty() const {
 void Tokenizer::pop() {
 	if (buffer.empty()) read();
 	buffer.pop_front();
+	positions.pop_front();
 }
 
 /**
@@ -29,6 +30,7 @@ void Tokenizer::pop() {
  */
 void Tokenizer::push(const std::string& token) {
 	buffer.push_front(token);
+	positions.push_front(positions.empty() ? Position() : positions.front());
 }
 
 /**
@@ -40,9 +42,31 @@ const std::string& Tokenizer::top() const {
 }
 
 /**
- * Reads a token from the source.
+ * Gets the position of the current token.
+ */
+Position Tokenizer::position() const {
+	if (buffer.empty()) read();
+	return positions.front();
+}
+
+/**
+ * Reads a token from the source, reporting errors at the position where they
+ * were found.
  */
 bool Tokenizer::read() const {
+	try {
+		return read_token();
+	} catch (const LocatedError&) {
+		throw;
+	} catch (const std::runtime_error& error) {
+		throw LocatedError(source.position(), error.what());
+	}
+}
+
+/**
+ * Reads a token and records its position.
+ */
+bool Tokenizer::read_token() const {
 
 	if (source.empty()) return false;
 
@@ -52,10 +76,12 @@ bool Tokenizer::read() const {
 	ignore_silence();
 	if (source.empty()) return false;
 
+	auto start = source.position();
 	if (accept_string(accept)
 		|| single(is<'('>, accept)
 		|| single(is<')'>, accept)) {
 		buffer.push_back(token);
+		positions.push_back(start);
 		return true;
 	}
 
@@ -68,7 +94,7 @@ bool Tokenizer::read() const {
 			maximum.clear();
 			for (auto i = context.tokens_begin();
 				i != context.tokens_end(); ++i)
-				if (std::equal(i->begin(), i->end(), token.begin())) {
+				if (token.compare(0, i->size(), *i) == 0) {
 					if (maximum.size() < i->size())
 						maximum = *i;
 				}
@@ -83,10 +109,14 @@ bool Tokenizer::read() const {
 		}
 		if (!normal.empty()) {
 			buffer.push_back(normal);
+			positions.push_back(start);
+			start.column += utf8::distance(normal.begin(), normal.end());
 			normal.clear();
 		}
 		if (!maximum.empty()) {
 			buffer.push_back(maximum);
+			positions.push_back(start);
+			start.column += utf8::distance(maximum.begin(), maximum.end());
 			auto first = token.begin();
 			utf8::advance(first,
 				utf8::distance(maximum.begin(), maximum.end()),
@@ -105,11 +135,14 @@ bool Tokenizer::read() const {
 void Tokenizer::ignore_silence() const {
 	bool matched = true;
 	while (matched) {
-		matched = multiple(::isspace);
+		matched = multiple(is_space);
 		if ((matched = single(is<'#'>))) {
 			if (single(is<'('>)) {
 				int depth = 1;
 				while (depth) {
+					if (source.empty())
+						throw std::runtime_error
+							("Expected end of comment before EOF.");
 					if (single(is<'('>))
 						++depth;
 					else if (single(is<')'>))
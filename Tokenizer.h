@@ -17,6 +17,7 @@ class Reader;
  */
 class Tokenizer {
 	mutable std::deque<std::string> buffer;
+	mutable std::deque<Position> positions;
 	mutable Reader& source;
 	Context& context;
 public:
@@ -25,13 +26,16 @@ public:
 	void pop();
 	void push(const std::string&);
 	const std::string& top() const;
+	Position position() const;
 private:
 	bool read() const;
+	bool read_token() const;
 	void ignore_silence() const;
 	template<class O> bool accept_string(O) const;
 	static bool any(uint32_t);
 	template<uint32_t C> static bool is(uint32_t);
 	template<uint32_t C> static bool is_not(uint32_t);
+	static bool is_space(uint32_t);
 	static bool is_word(uint32_t);
 	template<class P, class O = Ignorer> bool single(P, O = O()) const;
 	template<class P, class O = Ignorer> bool multiple(P, O = O()) const;
@@ -48,8 +52,10 @@ bool Tokenizer::accept_string(O accept) const {
 			("Expected closing quote before EOF.");
 	while (true) {
 		if (single(is<'\\'>)) {
-			throw std::runtime_error("Expected escape before EOF.");
-			single(is<'\\'>, accept) || single(is<'"'>, accept);
+			if (source.empty())
+				throw std::runtime_error("Expected escape before EOF.");
+			if (!single(is<'\\'>, accept) && !single(is<'"'>, accept))
+				throw std::runtime_error("Invalid escape in string.");
 		} else if (single(is<'"'>)) {
 			break;
 		} else {
@@ -85,11 +91,19 @@ bool Tokenizer::is_not(uint32_t c) {
 	return c != C;
 }
 
+/**
+ * Matches an ASCII whitespace character.
+ */
+inline bool Tokenizer::is_space(uint32_t c) {
+	return c < 0x80 && ::isspace(c);
+}
+
 /**
  * Matches a word (identifier) character.
  */
 inline bool Tokenizer::is_word(uint32_t c) {
-	return std::string(" \n\r\t\v()#").find(c) == std::string::npos;
+	return c >= 0x80
+		|| std::string(" \n\r\t\v()#").find(char(c)) == std::string::npos;
 }
 
 /**
@@ -0,0 +1,63 @@
+/**
+ * @file Trace.cpp
+ */
+#include "Trace.h"
+#include "Term.h"
+#include <ostream>
+
+/**
+ * Constructs a trace that writes to a stream, recording only builtins run at
+ * or above the given call depth.
+ */
+Trace::Trace(std::ostream& stream, std::size_t max_depth)
+	: stream(stream), max_depth(max_depth) {}
+
+/**
+ * Writes any records still buffered.
+ */
+Trace::~Trace() {
+	flush();
+}
+
+/**
+ * Appends an unsigned integer in seven-bit groups, least significant first.
+ */
+void Trace::integer(uint64_t value) {
+	while (value >= 0x80) {
+		buffer += char((value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	buffer += char(value);
+}
+
+/**
+ * Records a builtin and its effect on the stack.
+ */
+void Trace::record(int64_t operation, std::size_t depth, std::size_t before,
+	std::size_t after, const Term* top) {
+	if (depth > max_depth)
+		return;
+	integer(operation);
+	integer(depth);
+	integer(before);
+	integer(after);
+	uint64_t hash = 14695981039346656037ull;
+	if (top) {
+		std::string serialized;
+		top->serialize(serialized);
+		for (auto i = serialized.begin(); i != serialized.end(); ++i)
+			hash = (hash ^ uint8_t(*i)) * 1099511628211ull;
+	}
+	for (int i = 0; i < 8; ++i)
+		buffer += char(hash >> i * 8);
+	if (buffer.size() >= 65536)
+		flush();
+}
+
+/**
+ * Writes buffered records to the stream.
+ */
+void Trace::flush() {
+	stream.write(buffer.data(), buffer.size());
+	buffer.clear();
+}
@@ -0,0 +1,35 @@
+/**
+ * @file Trace.h
+ */
+#ifndef TRACE_H
+#define TRACE_H
+#include <cstdint>
+#include <iosfwd>
+#include <limits>
+#include <string>
+
+class Term;
+
+/**
+ * A compact binary log of the builtins evaluated by a Context. Each record
+ * holds the builtin, the call depth at which it ran, and the sizes of the
+ * stack before and after it, as variable-length integers, followed by a 64-bit
+ * hash of the value on top of the stack afterward. Apply and cond are recorded
+ * once they have taken their arguments, before the body they chose runs. A
+ * trace depends only on the program and the evaluator, so two traces of one
+ * program can be compared byte for byte.
+ */
+class Trace {
+	std::ostream& stream;
+	std::size_t max_depth;
+	std::string buffer;
+	void integer(uint64_t);
+public:
+	Trace(std::ostream&,
+		std::size_t = std::numeric_limits<std::size_t>::max());
+	~Trace();
+	void record(int64_t, std::size_t, std::size_t, std::size_t, const Term*);
+	void flush();
+};
+
+#endif
@@ -0,0 +1,26 @@
+/**
+ * @file Usage.h
+ */
+#ifndef USAGE_H
+#define USAGE_H
+#include <cstdint>
+
+/**
+ * Counts the bytes held by Terms, strings and Codes on behalf of the run in
+ * progress on this thread, so that each run is held to its own memory limit
+ * without threads contending for a shared count. Bytes are credited to the run
+ * that releases them, whichever run allocated them, so a count may fall below
+ * zero. Allocations made outside any run are not counted.
+ */
+class Usage {
+	static inline thread_local int64_t* current = nullptr;
+	int64_t* previous;
+public:
+	explicit Usage(int64_t& count) : previous(current) { current = &count; }
+	~Usage() { current = previous; }
+	Usage(const Usage&) = delete;
+	Usage& operator=(const Usage&) = delete;
+	static void charge(int64_t bytes) { if (current) *current += bytes; }
+};
+
+#endif
@@ -3,32 +3,205 @@
  *
  * Manages the state of the interpreter.
  */
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <stdexcept>
+#include "Batch.h"
+#include "Image.h"
+#include "Trace.h"
 #include "very.h"
 
+#ifndef VERY_FUZZ
+
+/**
+ * Parses a numeric command-line argument.
+ */
+static uint64_t parse_count(const char* argument) {
+	char* end;
+	errno = 0;
+	auto value = std::strtoull(argument, &end, 10);
+	if (errno || end == argument || *end || *argument == '-')
+		throw std::runtime_error("Invalid command line.");
+	return value;
+}
+
+/**
+ * Prepares the Context from which the programs in a batch start: restores it
+ * from an image if one is given, then evaluates the prelude if one is given.
+ */
+static void prepare(Context& context, bool optimized, bool verbose,
+	const Context::limits& limits, const char* image, const char* prelude,
+	bool prefetch) {
+	context.set_verbose(verbose);
+	context.set_limits(limits);
+	context.set_optimized(optimized);
+	if (image)
+		Image::load(context, image);
+	if (prelude) {
+		std::ifstream file(prelude);
+		if (!file)
+			throw std::runtime_error("Unable to open prelude.");
+		evaluate(file, context, prefetch, prelude);
+	}
+}
+
 /**
- * Runs source whose filename is given on the command line.
+ * Runs source whose filename is given on the command line, or standard input
+ * if the filename is "-" or absent. With --prefetch, input is decoded on a
+ * background thread while the program runs; the program cannot then come from
+ * standard input, which it may also read through port 0. With --verbose,
+ * definitions that are folded to constants are reported. With --image FILE,
+ * the Context is restored from an image before running; with --save-image
+ * FILE, it is saved to an image afterward. With --statistics, inline cache hit
+ * rates are reported when the program finishes. --max-steps, --max-memory (in
+ * bytes), --max-stack, and --max-depth bound the run, which fails cleanly if
+ * any limit is exceeded; the native stack bounds the call depth as well.
+ * With --no-files, the program may not open or require files.
+ *
+ * With --batch, every remaining argument is a program, or a directory of
+ * ".very" programs, and each is run in turn with its output written to its
+ * own ".out" file, in the directory given by --output-dir if any. Programs in
+ * a batch start with the definitions made by the program given by --prelude,
+ * which is evaluated once.
+ *
+ * With --reference, optimizations are disabled. With --trace FILE, a binary
+ * trace of the builtins evaluated is written to a file; traces of one program
+ * can be compared across builds. --differential takes programs as --batch
+ * does, runs each with and without optimizations, and reports any difference
+ * in output or in the builtins evaluated at the top level. --trace-depth N
+ * traces builtins evaluated at call depths up to N, rather than at any depth
+ * for --trace or only at the top level for --differential. The prelude is
+ * evaluated once with and once without optimizations, so that each run starts
+ * from definitions made the same way it is. --trace, --statistics, and
+ * --save-image describe a single run, so they cannot be combined with --batch
+ * or --differential.
  */
 int main(int argc, char** argv) try {
 
 	--argc, ++argv;
-	if (argc != 1)
+	bool prefetch = false;
+	bool verbose = false;
+	bool statistics = false;
+	bool batch = false;
+	bool differential = false;
+	bool reference = false;
+	const char* trace_file = nullptr;
+	const char* trace_depth = nullptr;
+	const char* prelude = nullptr;
+	const char* output_directory = "";
+	const char* image = nullptr;
+	const char* save_image = nullptr;
+	Context::limits limits;
+	for (; argc && std::strncmp(argv[0], "--", 2) == 0; --argc, ++argv) {
+		if (std::strcmp(argv[0], "--prefetch") == 0)
+			prefetch = true;
+		else if (std::strcmp(argv[0], "--verbose") == 0)
+			verbose = true;
+		else if (std::strcmp(argv[0], "--statistics") == 0)
+			statistics = true;
+		else if (std::strcmp(argv[0], "--max-steps") == 0 && argc > 1)
+			--argc, limits.steps = parse_count(*++argv);
+		else if (std::strcmp(argv[0], "--max-memory") == 0 && argc > 1)
+			--argc, limits.memory = parse_count(*++argv);
+		else if (std::strcmp(argv[0], "--max-stack") == 0 && argc > 1)
+			--argc, limits.stack = parse_count(*++argv);
+		else if (std::strcmp(argv[0], "--max-depth") == 0 && argc > 1)
+			--argc, limits.depth = parse_count(*++argv);
+		else if (std::strcmp(argv[0], "--no-files") == 0)
+			limits.files = false;
+		else if (std::strcmp(argv[0], "--batch") == 0)
+			batch = true;
+		else if (std::strcmp(argv[0], "--differential") == 0)
+			differential = true;
+		else if (std::strcmp(argv[0], "--reference") == 0)
+			reference = true;
+		else if (std::strcmp(argv[0], "--trace") == 0 && argc > 1)
+			--argc, trace_file = *++argv;
+		else if (std::strcmp(argv[0], "--trace-depth") == 0 && argc > 1)
+			--argc, trace_depth = *++argv;
+		else if (std::strcmp(argv[0], "--prelude") == 0 && argc > 1)
+			--argc, prelude = *++argv;
+		else if (std::strcmp(argv[0], "--output-dir") == 0 && argc > 1)
+			--argc, output_directory = *++argv;
+		else if (std::strcmp(argv[0], "--image") == 0 && argc > 1)
+			--argc, image = *++argv;
+		else if (std::strcmp(argv[0], "--save-image") == 0 && argc > 1)
+			--argc, save_image = *++argv;
+		else
+			throw std::runtime_error("Invalid command line.");
+	}
+
+	if (batch || differential) {
+		if ((batch && differential) || (differential && reference)
+			|| (batch && trace_depth) || trace_file || statistics
+			|| save_image)
+			throw std::runtime_error("Invalid command line.");
+		Context optimized;
+		Context unoptimized;
+		prepare(optimized, !reference, verbose, limits, image, prelude,
+			prefetch);
+		if (differential)
+			prepare(unoptimized, false, verbose, limits, image, prelude,
+				prefetch);
+		Batch driver(optimized, differential ? unoptimized : optimized,
+			limits, prefetch, output_directory);
+		if (trace_depth)
+			driver.set_depth(parse_count(trace_depth));
+		bool succeeded = true;
+		auto inputs = Batch::expand(std::vector<std::string>(argv, argv + argc));
+		for (auto i = inputs.begin(); i != inputs.end(); ++i)
+			succeeded &= differential ? driver.compare(*i) : driver.run(*i);
+		return succeeded ? 0 : 1;
+	}
+
+	if (argc > 1 || prelude || (trace_depth && !trace_file))
 		throw std::runtime_error("Invalid command line.");
 
+	std::ifstream file;
+	bool standard = argc == 0 || std::strcmp(argv[0], "-") == 0;
+	if (standard && prefetch)
+		throw std::runtime_error("Invalid command line.");
+	if (!standard) {
+		file.open(argv[0]);
+		if (!file)
+			throw std::runtime_error("Unable to open input file.");
+	}
+	std::istream& stream = standard ? std::cin : file;
+
+	std::ofstream trace_stream;
+	std::unique_ptr<Trace> trace;
+	if (trace_file) {
+		trace_stream.open(trace_file, std::ios::binary);
+		if (!trace_stream)
+			throw std::runtime_error("Unable to open trace file.");
+		trace.reset(new Trace(trace_stream, trace_depth
+			? parse_count(trace_depth)
+			: std::numeric_limits<std::size_t>::max()));
+	}
+
 	Context context;
-	std::ifstream stream(argv[0]);
-	Reader reader(stream);
-	Tokenizer tokenizer(reader, context);
-	Parser parser(tokenizer);
-	Expander expander(parser, context);
-	Interpreter interpreter(expander, context);
-	force(interpreter);
+	context.set_verbose(verbose);
+	context.set_limits(limits);
+	context.set_optimized(!reference);
+	context.set_trace(trace.get());
+	if (image)
+		Image::load(context, image);
+	evaluate(stream, context, prefetch, standard ? "" : argv[0]);
+	if (save_image)
+		Image::save(context, save_image);
+	if (statistics)
+		context.print_statistics(std::cerr);
 
-} catch (const std::runtime_error& error) {
+} catch (const std::exception& error) {
 
 	std::cerr << error.what() << '\n';
 	return 1;
 
 }
+
+#endif
@@ -10,7 +10,13 @@
 #include "Interpreter.h"
 
 /**
- * Forces lazy computation expressed through stack composition.
+ * Forces lazy computation expressed through stack composition. Each stage
+ * buffers only what it needs to produce its next element: the Reader a few
+ * characters, the Tokenizer the tokens of one word, the Parser one top-level
+ * Term, and the Expander one Term of lookahead after a string or array, which
+ * might name a token. Memory use is thus bounded by the largest top-level Term
+ * plus the Context, independently of the length of the input, and each Term is
+ * released once it has been evaluated.
  * @tparam S     Stack type.
  * @param  stack Stack itself.
  */
@@ -19,4 +25,23 @@ void force(S& stack) {
 	while (!stack.empty()) stack.pop();
 }
 
+/**
+ * Evaluates a program read from a stream.
+ * @param stream   Source of the program.
+ * @param context  Context in which to evaluate it.
+ * @param prefetch Whether to decode the stream on a background thread.
+ * @param name     Name of the source given with errors, or empty for none.
+ */
+inline void evaluate(std::istream& stream, Context& context, bool prefetch,
+	const std::string& name = std::string()) {
+	auto usage = context.track();
+	Reader reader(stream, prefetch,
+		name.empty() ? nullptr : context.name_source(name));
+	Tokenizer tokenizer(reader, context);
+	Parser parser(tokenizer, context);
+	Expander expander(parser, context);
+	Interpreter interpreter(expander, context);
+	force(interpreter);
+}
+
 #endif